@@ -21,6 +21,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 #ifdef _WIN32
 char *strsep(char **str, const char *separators) {
@@ -56,6 +66,27 @@ char *strsep(char **str, const char *separators) {
 #define CONNECTOR_OUTLINE_GAP 10
 #define CONNECTOR_SPACING_X 200
 #define CONNECTOR_SPACING_Y 30
+// Most columns the layout can pack connectors into
+#define MAX_COLUMNS 8
+// Side of a spatial grid cell, in world units
+#define GRID_CELL_SIZE 256.0f
+// Wire bounding boxes are padded by this much beyond half the line thickness,
+// for the highlight outline and the pointer tolerance
+#define WIRE_BOUNDS_MARGIN 8.0f
+// A wire is under the pointer within this many screen pixels of its edge
+#define WIRE_HIT_TOLERANCE 4.0f
+// Straight pieces a curve is split into for hit-testing
+#define WIRE_HIT_SEGMENTS 16
+// Rubber bands smaller than this many screen pixels are clicks
+#define BAND_MIN_SIZE 4.0f
+// Lasso points are at least this many screen pixels apart
+#define LASSO_POINT_SPACING 6.0f
+// Connectors with more pins than this start out showing a scrolling window
+// of PIN_WINDOW_ROWS pins
+#define COLLAPSE_PIN_COUNT 64
+#define PIN_WINDOW_ROWS 24
+// Pin rows scrolled per mouse wheel step
+#define PIN_SCROLL_ROWS 3
 #define FILE_LINE_MAX_LEN 256
 #define DEFAULT_HIGHLIGHT_COLOR "DARKGOLD"
 #define DEFAULT_FOREGROUND_COLOR_LIGHT "BLACK"
@@ -67,124 +98,825 @@ char *strsep(char **str, const char *separators) {
 #define ZOOM_RATE 0.02
 #define MINIMUM_ZOOM 0.3
 #define MAXIMUM_ZOOM 3.0
+// Fonts are rasterized at the largest zoom and scaled down by the camera
+#define FONT_RASTER_SCALE MAXIMUM_ZOOM
+#define STRING_ARENA_BLOCK_SIZE 65536
+#define STRING_TABLE_INITIAL_SLOTS 1024
+#define WIRE_TABLE_INITIAL_SIZE 64
+#define MAX_ENDPOINT_NUMBER 0xFFFF
+// Snapshots copy wires in chunks of this many rows and connectors in blocks of
+// this many records, and share the ones that have not changed
+#define SNAPSHOT_WIRE_CHUNK_ROWS 1024
+#define SNAPSHOT_CONNECTOR_BLOCK_SIZE 32
+// Compact the wire table once this fraction of its rows are deleted
+#define WIRE_COMPACTION_THRESHOLD 0.25
+#define WIRE_COMPACTION_MIN_DEAD 64
+// Most barycentric passes made by order_connectors()
+#define ORDER_SWEEPS 24
+// order_connectors() gives up after this many passes without fewer crossings
+#define ORDER_PATIENCE 4
+
+#define SPLICE_DOT_RADIUS 3.0
+#define SPLICE_HIT_HALF_WIDTH 4.0
+// Most nets that can be lit at once (pins and splices under the pointer)
+#define MAX_LIT_NETS 8
+// Wires appended since the vertex index was built are scanned one by one
+// until there are this many; see vertex_wires_t
+#define VERTEX_WIRES_MAX_APPENDED 256
+
+// A wire end packed as connector number (high 16 bits) and pin number (low 16 bits)
+typedef uint32_t endpoint_t;
+#define ENDPOINT(connector, pin) ((endpoint_t)(((uint32_t)(connector) << 16) | ((uint32_t)(pin) & 0xFFFF)))
+#define ENDPOINT_CONNECTOR(e) ((int)((e) >> 16))
+#define ENDPOINT_PIN(e) ((int)((e) & 0xFFFF))
+// Wire ends at a splice use connector number 0 and the splice number as the pin
+#define SPLICE_CONNECTOR 0
+#define ENDPOINT_IS_SPLICE(e) (ENDPOINT_CONNECTOR(e) == SPLICE_CONNECTOR)
+
+// Variant membership: bit i is set for the i'th variant declared by the
+// harness. Untagged connectors and wires belong to every variant.
+typedef uint64_t variant_mask_t;
+#define MAX_VARIANTS 64
+#define ALL_VARIANTS (~(variant_mask_t)0)
+#define VARIANT_BIT(i) ((variant_mask_t)1 << (i))
+
+// Interned string handle. Id 0 is always the empty string.
+typedef uint32_t string_id_t;
+
+typedef struct string_arena_block {
+    struct string_arena_block *next;
+    size_t used;
+    size_t size;
+    char data[];
+} string_arena_block_t;
+
+// All names, types and wire attributes are interned here so that duplicates
+// share storage and compare as integers. Teardown frees the arena in one go.
+// The strings array is never resized in place: when it fills, a larger copy
+// is made in the arena and the old one is left there, so a snapshot of the
+// table (see model_snapshot_t) can keep reading the ids it knows about while
+// new strings are added.
+typedef struct string_table {
+    string_arena_block_t *blocks;
+    const char **strings;
+    uint32_t *hashes;
+    uint32_t n_strings;
+    uint32_t max_strings;
+    // Open-addressed hash of string ids; 0 marks an empty slot
+    string_id_t *slots;
+    uint32_t n_slots;
+} string_table_t;
 
 typedef struct pin {
     int number;
-    char *name;
-    int is_highlighted;
-    int is_under_pointer;
+    string_id_t name;
 } pin_t;
 
+// Value view of one wire, read and written through get_wire()/set_wire()
 typedef struct wire_description {
     int c1;
     int c1_pin;
     int c2;
     int c2_pin;
-    char *colour;
+    string_id_t colour;
     float thickness;
     float straight_fraction;
-    char *gauge;
-    char *length;
-    int is_highlighted;
+    // Overrides of the harness defaults; 0 means use the default
+    string_id_t gauge;
+    string_id_t length;
+    variant_mask_t variants;
 } wire_description_t;
 
+// Gauge and length are almost always the harness defaults, so they are not
+// stored per wire. Wires that override either one get an entry in a side
+// table kept sorted by wire row.
+typedef struct wire_override {
+    int wire;
+    string_id_t gauge;
+    string_id_t length;
+} wire_override_t;
+
+// Wires are stored column-wise. The endpoint columns are scanned for every
+// pin, so they are kept narrow and contiguous; attributes only needed for
+// drawing and export live in their own columns.
+// Deleted wires stay in place, marked in the dead bitmap, until the table is
+// compacted. Loops over rows must skip them with WIRE_IS_DEAD().
+typedef struct wire_table {
+    // Bumped whenever wires are added, removed or moved, so that anything
+    // derived from the wiring can tell when it is stale
+    uint32_t version;
+    // Bumped only when rows are moved by compact_wires()
+    uint32_t compactions;
+    int n_wires;
+    int max_wires;
+    int n_dead;
+    uint64_t *dead;
+    uint32_t *generation;
+    endpoint_t *end1;
+    endpoint_t *end2;
+    string_id_t *colour;
+    float *thickness;
+    float *straight_fraction;
+    variant_mask_t *variants;
+    int n_overrides;
+    int max_overrides;
+    wire_override_t *overrides;
+    // Chunks of SNAPSHOT_WIRE_CHUNK_ROWS rows written since the last snapshot
+    // was published, and whether the overrides were; see snapshot_harness()
+    uint64_t *changed_chunks;
+    uint8_t overrides_changed;
+} wire_table_t;
+
+#define BITSET_WORDS(n) (((n) + 63) / 64)
+#define BITSET_TEST(b, i) (((b)[(i) >> 6] >> ((i) & 63)) & 1)
+#define BITSET_SET(b, i) ((b)[(i) >> 6] |= (uint64_t)1 << ((i) & 63))
+#define BITSET_CLEAR(b, i) ((b)[(i) >> 6] &= ~((uint64_t)1 << ((i) & 63)))
+
+#define WIRE_IS_DEAD(t, i) BITSET_TEST((t)->dead, (i))
+// Every write to a row, its dead bit included, goes through here
+#define MARK_WIRE_CHANGED(t, i) BITSET_SET((t)->changed_chunks, (i) / SNAPSHOT_WIRE_CHUNK_ROWS)
+
+// Stable reference to a connector, pin or wire. The generation is checked
+// against the slot on every resolve, so a handle to something that has been
+// deleted, reallocated or reloaded resolves to nothing rather than dangling.
+// Generations come from one counter, so handles are unique across harnesses.
+// Generation 0 is never issued.
+typedef struct handle {
+    uint32_t index;
+    uint32_t generation;
+} handle_t;
+
+#define NULL_HANDLE ((handle_t){0, 0})
+#define HANDLES_EQUAL(a, b) ((a).index == (b).index && (a).generation == (b).generation)
+// Index of a wire handle in the edit history whose row has been compacted
+// away; the generation still names the wire
+#define COMPACTED_WIRE UINT32_MAX
+// Pin handles pack the connector slot (high 16 bits) and pin slot (low 16 bits)
+// and carry their connector's generation.
+#define PIN_HANDLE_INDEX(connector_index, pin_index) (((uint32_t)(connector_index) << 16) | ((uint32_t)(pin_index) & 0xFFFF))
+
+// Splices join any number of wires at one point, so a splice feeding n pins
+// needs n wires rather than a wire per pin pair. Splices are numbered from 1
+// in the order they are declared in the wiring section.
+typedef struct splice {
+    string_id_t name;
+} splice_t;
+
+// Writes the keys (at most two) that item is filed under into keys and
+// returns how many there are; see build_csr()
+typedef int (*csr_keys_fn)(const void *context, int item, int *keys);
+
+// Wires attached to each splice in compressed sparse row form: the wires at
+// splice s (0-based) are wires[offsets[s]] to wires[offsets[s + 1] - 1].
+typedef struct splice_graph {
+    uint32_t version;
+    int n_splices;
+    int *offsets;
+    int *wires;
+    int max_wires;
+} splice_graph_t;
+
+// Wires by the net vertex of their first valid end, in compressed sparse row
+// form. Every wire touching a net is filed under one of the net's vertices,
+// so a net's wires are found by walking its vertices. Rows are filed whether
+// deleted or not, since deleting and reviving wires does not move them; the
+// index is only rebuilt after compaction or once more than
+// VERTEX_WIRES_MAX_APPENDED rows have been appended past n_rows. Rows from
+// n_rows on are not filed and have to be looked at separately.
+typedef struct vertex_wires {
+    uint32_t compactions;
+    int n_rows;
+    int n_vertices;
+    int *offsets;
+    int max_offsets;
+    int *wires;
+    int max_wires;
+} vertex_wires_t;
+
+// Electrical nets of one harness under one variant selection, kept as a
+// union-find over its pins and splices. Pin id p is vertex p and splice s
+// (from 0) is vertex n_pins + s; a net's id is its root vertex. The vertices
+// of each net are also linked in a circular list through next, so that one
+// net can be recomputed without touching the others.
+typedef struct net_table {
+    // Wire table version and variants the nets were computed for
+    uint32_t version;
+    variant_mask_t variants;
+    int n_vertices;
+    int *parent;
+    int *rank;
+    int *next;
+    uint64_t *mark;
+    // Scratch list of the vertices of a net being split
+    int *members;
+} net_table_t;
+
 typedef struct connector_description {
-    char *name;
+    string_id_t name;
     int number;
-    char *type;
-    char *mate;
+    string_id_t type;
+    string_id_t mate;
     pin_t *pins;
     int n_pins;
     int mirror_lr;
+    variant_mask_t variants;
+    // Bumped whenever the connector or its pin array is recreated
+    uint32_t generation;
+    // Harness-wide id of pins[0]; pin k has id first_pin + k
+    int first_pin;
+    // Set when the connector has been dragged to (x, y) in world
+    // coordinates, instead of being stacked in a column
+    int placed;
+    float x;
+    float y;
 } connector_description_t;
 
+#define SNAPSHOT_CONNECTOR_BLOCKS(n) (((n) + SNAPSHOT_CONNECTOR_BLOCK_SIZE - 1) / SNAPSHOT_CONNECTOR_BLOCK_SIZE)
+#define SNAPSHOT_WIRE_CHUNKS(n) (((n) + SNAPSHOT_WIRE_CHUNK_ROWS - 1) / SNAPSHOT_WIRE_CHUNK_ROWS)
+
 typedef struct harness_description {
-    char *name;
-    // TODO allow pin overrides of the wire length
-    // Specified as a string to allow arbitrary units
-    char *default_wire_length;
-    // TODO allow pin overrides of the wire gauge
-    char *default_wire_gauge;
-    char *default_wire_colour;
+    string_id_t name;
+    // Specified as a string to allow arbitrary units. Individual wires can
+    // override the length and gauge (see wire_override_t).
+    string_id_t default_wire_length;
+    string_id_t default_wire_gauge;
+    string_id_t default_wire_colour;
+    int n_variants;
+    string_id_t variant_names[MAX_VARIANTS];
     int n_connector_descriptions;
     connector_description_t *connector_descriptions;
-    int n_wire_descriptions;
-    wire_description_t *wire_descriptions;
+    int n_pins;
+    int n_splices;
+    splice_t *splices;
+    wire_table_t wires;
+    // Derived from wires; see update_splice_graph(), update_vertex_wires()
+    // and update_nets()
+    splice_graph_t splice_graph;
+    vertex_wires_t vertex_wires;
+    net_table_t nets;
     int changed;
+    // Set from program_state_t.revision by every edit of the harness
+    uint32_t revision;
+    // Blocks of SNAPSHOT_CONNECTOR_BLOCK_SIZE connector records changed since
+    // the last snapshot was published; NULL until the first one, meaning all
+    // of them. See mark_connector_changed().
+    uint64_t *changed_connector_blocks;
 } harness_description_t;
 
+// Copy of SNAPSHOT_CONNECTOR_BLOCK_SIZE connector records, shared by
+// harness snapshots until one of the records is edited
+typedef struct connector_block {
+    atomic_int refs;
+    connector_description_t connectors[SNAPSHOT_CONNECTOR_BLOCK_SIZE];
+} connector_block_t;
+
+// Copy of SNAPSHOT_WIRE_CHUNK_ROWS rows of a wire table, column-wise like
+// the table, shared by harness snapshots until one of the rows is written
+typedef struct wire_chunk {
+    atomic_int refs;
+    uint64_t dead[BITSET_WORDS(SNAPSHOT_WIRE_CHUNK_ROWS)];
+    uint32_t generation[SNAPSHOT_WIRE_CHUNK_ROWS];
+    endpoint_t end1[SNAPSHOT_WIRE_CHUNK_ROWS];
+    endpoint_t end2[SNAPSHOT_WIRE_CHUNK_ROWS];
+    string_id_t colour[SNAPSHOT_WIRE_CHUNK_ROWS];
+    float thickness[SNAPSHOT_WIRE_CHUNK_ROWS];
+    float straight_fraction[SNAPSHOT_WIRE_CHUNK_ROWS];
+    variant_mask_t variants[SNAPSHOT_WIRE_CHUNK_ROWS];
+} wire_chunk_t;
+
+typedef struct override_block {
+    atomic_int refs;
+    int n_overrides;
+    wire_override_t overrides[];
+} override_block_t;
+
+// Immutable copy of one harness, shared by consecutive model snapshots for as
+// long as the harness is not edited. When it is, the new copy shares the
+// connector blocks and wire chunks that were not written with the old one,
+// so an edit copies only what it touched. Connector pins and splices never
+// change after loading, so they are borrowed from the live model.
+// description holds the scalars only: its connector records and wire columns
+// are read through SNAPSHOT_CONNECTOR() and SNAPSHOT_WIRE(), and its override
+// table points into overrides.
+typedef struct harness_snapshot {
+    atomic_int refs;
+    harness_description_t description;
+    int n_connector_blocks;
+    connector_block_t **connector_blocks;
+    int n_wire_chunks;
+    wire_chunk_t **wire_chunks;
+    override_block_t *overrides;
+} harness_snapshot_t;
+
+#define SNAPSHOT_CONNECTOR(hs, c) (&(hs)->connector_blocks[(c) / SNAPSHOT_CONNECTOR_BLOCK_SIZE]->connectors[(c) % SNAPSHOT_CONNECTOR_BLOCK_SIZE])
+#define SNAPSHOT_WIRE(hs, column, i) ((hs)->wire_chunks[(i) / SNAPSHOT_WIRE_CHUNK_ROWS]->column[(i) % SNAPSHOT_WIRE_CHUNK_ROWS])
+#define SNAPSHOT_WIRE_IS_DEAD(hs, i) BITSET_TEST((hs)->wire_chunks[(i) / SNAPSHOT_WIRE_CHUNK_ROWS]->dead, (i) % SNAPSHOT_WIRE_CHUNK_ROWS)
+
+// A consistent, read-only view of the whole model for use off the render
+// thread. The editor publishes a new snapshot after edits and swaps it into
+// program_state_t.snapshot; readers hold a reference for as long as they need
+// it, and the last one to let go frees it. Only the render thread takes new
+// references, so a reference is never taken to a snapshot that is being freed.
+typedef struct model_snapshot {
+    atomic_int refs;
+    uint32_t revision;
+    int dark_background;
+    // Shares the live table's arena; only strings and n_strings are valid
+    string_table_t strings;
+    int n_harnesses;
+    harness_snapshot_t **harnesses;
+} model_snapshot_t;
+
+// Writes a snapshot to a file on a worker thread. harness is -1 to write every
+// harness, otherwise that harness alone, limited to variant if variant >= 0.
+typedef struct save_job {
+    pthread_t thread;
+    int running;
+    atomic_int done;
+    int status;
+    model_snapshot_t *snapshot;
+    char filename[FILE_LINE_MAX_LEN];
+    int harness;
+    int variant;
+} save_job_t;
+
+// Where a connector is drawn, for order_connectors(): its column, whether its
+// wires leave from its left edge, and whether it was placed by hand
+typedef struct order_place {
+    uint8_t column;
+    uint8_t facing_left;
+    uint8_t placed;
+} order_place_t;
+
+// Reorders the connectors of one harness on a worker thread, from a snapshot;
+// see order_connectors(). order is set while a job is outstanding and holds
+// the order the job started from, and the new one once done is set. running
+// is set while there is a thread to join.
+typedef struct order_job {
+    pthread_t thread;
+    int running;
+    atomic_int done;
+    int status;
+    model_snapshot_t *snapshot;
+    int harness;
+    variant_mask_t variants;
+    int n_connectors;
+    int *order;
+    // The columns the connectors were drawn in when the job started
+    int n_columns;
+    order_place_t *places;
+} order_job_t;
+
+// Lays out the harnesses either side of the one in view on a worker thread,
+// so that switching to them draws straight away. The worker writes only
+// those harnesses' layouts and reads the model, so the render thread waits
+// for it (finish_prefetch_job()) before editing the model, touching another
+// harness's layout or changing what layouts depend on. The job is not redone
+// until the harness in view, the column count or the model changes.
+typedef struct prefetch_job {
+    pthread_t thread;
+    int running;
+    atomic_int done;
+    struct program_state *state;
+    int n_harnesses;
+    int harnesses[2];
+    // What the last job was started for
+    int started;
+    int harness_index;
+    int n_columns;
+    int orthogonal;
+    uint32_t revision;
+} prefetch_job_t;
+
+// A wire between two layers (columns, and the gaps of splices between them)
+// for counting crossings
+typedef struct order_edge {
+    int layers;
+    float y1;
+    float y2;
+} order_edge_t;
+
+// Sort key of a connector within its column
+typedef struct order_key {
+    float key;
+    int rank;
+    int connector;
+} order_key_t;
+
+// Reversible edits, recorded as they are made so that undo and redo replay
+// only what changed
+typedef enum edit_kind {
+    EDIT_ADD_WIRE = 0,
+    EDIT_DELETE_WIRE,
+    EDIT_WIRE_VARIANTS,
+    EDIT_WIRE_COLOUR,
+    EDIT_WIRE_THICKNESS,
+    EDIT_MIRROR_CONNECTOR,
+    EDIT_MOVE_CONNECTOR
+} edit_kind_t;
+
+typedef union edit_value {
+    string_id_t colour;
+    float thickness;
+    variant_mask_t variants;
+    struct {
+        float x;
+        float y;
+        int placed;
+    } position;
+} edit_value_t;
+
+// Edits made by one command share a step and are undone and redone together
+typedef struct edit {
+    uint32_t step;
+    uint8_t kind;
+    int harness;
+    int connector;
+    handle_t wire;
+    union {
+        struct {
+            edit_value_t before;
+            edit_value_t after;
+        } change;
+        // Added and deleted wires are kept whole, in case their row has been
+        // compacted away by the time they are needed again
+        wire_description_t description;
+    };
+} edit_t;
+
+typedef struct edit_stack {
+    int n_edits;
+    int max_edits;
+    edit_t *edits;
+} edit_stack_t;
+
+typedef struct edit_history {
+    edit_stack_t undo;
+    edit_stack_t redo;
+    uint32_t step;
+} edit_history_t;
+
+// Fonts are loaded once into program_state_t.fonts and referred to by id.
+// Text is drawn at program_state_t.font_sizes, in world units.
+typedef enum font_id {
+    CONNECTOR_FONT = 0,
+    TITLE_FONT,
+    N_FONTS
+} font_id_t;
+
+// Layout of one connector: only measured sizes are kept. The type row and pin
+// rows are formatted from the description when they are drawn. Sizes are kept
+// from frame to frame and measured again only after needs_layout is set by
+// invalidate_layout() or invalidate_connector_layout().
+// Which pin rows a connector shows
+typedef enum pin_view {
+    PIN_VIEW_ALL = 0,
+    // Only the pins with wires, and a row counting the rest
+    PIN_VIEW_WIRED,
+    // PIN_WINDOW_ROWS pins from connector_t.first_row, between rows
+    // counting the pins above and below
+    PIN_VIEW_WINDOW
+} pin_view_t;
+
+// Rows that stand for hidden pins; wires to hidden pins attach to them
+#define ROW_MORE_ABOVE -1
+#define ROW_MORE_BELOW -2
+
 typedef struct connector {
     connector_description_t *description;
     Rectangle outline;
-    char max_str[LINE_MAX_LEN];
-    int max_letters;
-    char max_pin_str[LINE_MAX_LEN];
-    int max_pin_letters;
-    char typerow[LINE_MAX_LEN];
-    char pin_format[64];
-    Font font;
-    int font_spacing;
-    int line_height;
-    int is_highlighted;
+    float name_width;
+    float typerow_width;
+    // Right-aligned pin rows are padded to the same width
+    float pin_row_width;
+    int16_t line_height;
+    int16_t max_pin_letters;
+    uint8_t font;
+    uint8_t is_highlighted;
+    uint8_t needs_layout;
+    // Set by place_connectors()
+    uint8_t column;
+    // Pin rows are left-aligned and wires attach on the left edge
+    uint8_t facing_left;
+    // Left-aligned row widths are in harness_t.pin_widths
+    uint8_t left_rows_measured;
+    uint8_t pin_view;
+    // Pin rows shown, and the first pin of the window
+    int n_rows;
+    int first_row;
 } connector_t;
 
+// A splice is drawn as a vertical trunk in the gap between the columns, with
+// a straight branch to each pin
+typedef struct splice_layout {
+    float x;
+    float top;
+    float bottom;
+    float label_width;
+    // Gap between columns the trunk is drawn in
+    uint8_t gap;
+} splice_layout_t;
+
+// Control points of a wire between two connector pins, and their bounding
+// box, which contains the curve. A routed wire is the polyline through the
+// same four points instead, running vertically at track_x.
+typedef struct wire_curve {
+    Vector2 points[4];
+    Rectangle bounds;
+    float track_x;
+    uint8_t valid;
+} wire_curve_t;
+
+// The vertical run of a routed wire in one gap
+typedef struct track_interval {
+    float top;
+    float bottom;
+    int wire;
+    int gap;
+    int track;
+} track_interval_t;
+
+// A track in use, until bottom
+typedef struct track_end {
+    float bottom;
+    int track;
+} track_end_t;
+
+// An item in a cell is current only while its stamp matches the item's
+typedef struct grid_entry {
+    int item;
+    uint32_t stamp;
+} grid_entry_t;
+
+typedef struct grid_cell {
+    int32_t x;
+    int32_t y;
+    uint8_t used;
+    int n_entries;
+    int max_entries;
+    grid_entry_t *entries;
+} grid_cell_t;
+
+typedef struct grid_span {
+    int32_t x0;
+    int32_t y0;
+    int32_t x1;
+    int32_t y1;
+} grid_span_t;
+
+// Uniform grid over world space, for finding what lies in a rectangle without
+// looking at everything. Items are connectors (id = connector index) and
+// wires (id = number of connectors + wire row). Cells are kept in an
+// open-addressed hash on their coordinates, so the grid is unbounded and only
+// cells that have held something take memory. A long wire covers many cells,
+// so removing an item only bumps its stamp; the stale entries are dropped
+// when their cells are next visited.
+typedef struct spatial_grid {
+    int n_cells;
+    int n_slots;
+    grid_cell_t *cells;
+    int max_items;
+    uint32_t *stamps;
+    // Items already reported by the current query are marked with it
+    uint32_t *seen;
+    uint32_t query;
+} spatial_grid_t;
+
+// Pins and wires on the nets under the pointer. They are kept until the
+// hovered nets, the wiring or the variants change; see update_lit_set().
+typedef struct lit_set {
+    int roots[MAX_LIT_NETS];
+    int n_roots;
+    uint32_t wire_version;
+    variant_mask_t variants;
+    int n_vertices;
+    int *pins;
+    int n_pins;
+    int max_pins;
+    int *wires;
+    int n_wires;
+    int max_wires;
+} lit_set_t;
+
 typedef struct harness {
     harness_description_t *description;
     int n_connectors;
     connector_t *connectors;
-    Font title_font;
-    int title_font_spacing;
+    splice_layout_t *splices;
+    // Width of each pin's left-aligned row, by harness-wide pin id, for
+    // hit-testing; see measure_left_pin_rows()
+    float *pin_widths;
+    // Connector indexes in the order they are stacked in their columns
+    int *order;
+    // Pin shown on each row of a connector not showing all of its pins, at
+    // the connector's first pin id (or ROW_MORE_ABOVE / ROW_MORE_BELOW), and
+    // the row each pin's wires attach to, by pin id; see update_connector_rows()
+    int *row_pins;
+    int *pin_rows;
+    // Pins with at least one wire, by pin id
+    uint64_t *pin_wired;
+    uint32_t pin_wired_version;
+    uint32_t rows_wire_version;
+    // Left edges of the gaps between the columns
+    int n_gaps;
+    float gaps[MAX_COLUMNS];
+    // What the connectors were placed for
+    variant_mask_t layout_variants;
+    int layout_columns;
+    uint32_t layout_wire_version;
+    // Balanced columns are kept as an ordering left them while the column
+    // count and variants are those it was made for
+    int ordered_columns;
+    variant_mask_t ordered_variants;
+    // Wire curves by wire row, and the wires at each connector in compressed
+    // sparse row form; see update_wire_geometry()
+    wire_curve_t *curves;
+    int max_curves;
+    int *connector_wire_offsets;
+    int *connector_wires;
+    int max_connector_wires;
+    uint32_t geometry_wire_version;
+    uint8_t geometry_stale;
+    // The routing the geometry is for, and whether wire ends have moved
+    // since the tracks were assigned
+    uint8_t geometry_orthogonal;
+    uint8_t tracks_stale;
+    lit_set_t lit;
+    spatial_grid_t grid;
+    // Items in view, from the last grid query, in id order
+    int *visible;
+    int n_visible;
+    int max_visible;
+    uint8_t title_font;
+    // Set when any connector or splice label needs measuring
+    uint8_t needs_layout;
 } harness_t;
 
+// Per-view hover and highlight state, kept out of the harness model so that
+// the model is only read while drawing. Pin bits are indexed by harness-wide
+// pin id (connector_description_t.first_pin + pin index), wire bits by wire
+// table row. Everything is cleared at the start of each frame.
+typedef struct view_state {
+    int max_pin_words;
+    int max_wire_words;
+    uint64_t *pin_highlighted;
+    uint64_t *pin_under_pointer;
+    uint64_t *wire_highlighted;
+    // Pins found under the pointer by find_pins_under_pointer()
+    int hovered_pins[MAX_LIT_NETS];
+    string_id_t hovered_pin_names[MAX_LIT_NETS];
+    int n_hovered_pins;
+    // Nearest wire to the pointer when no pin is under it
+    handle_t wire_under_pointer;
+} view_state_t;
+
+// A connector being dragged with the mouse. Only the view moves until the
+// button is released.
+typedef struct connector_drag {
+    int active;
+    int harness;
+    int connector;
+    // From the connector's corner to the pointer
+    Vector2 grab;
+    Vector2 start;
+} connector_drag_t;
+
+// Wires and connectors of one harness picked with clicks or a rubber band,
+// by wire row and connector index. Edits act on the whole selection at once.
+typedef struct selection {
+    int harness;
+    int max_wire_words;
+    int max_connector_words;
+    uint64_t *wires;
+    uint64_t *connectors;
+} selection_t;
+
+// A box, or a lasso while control is held, dragged out from empty space to
+// select what lies inside it. A box is the two corners in points.
+typedef struct rubber_band {
+    int active;
+    int lasso;
+    // Shift adds to the selection instead of replacing it
+    int add;
+    Vector2 *points;
+    int n_points;
+    int max_points;
+    // Candidates from the grid
+    int *items;
+    int n_items;
+    int max_items;
+} rubber_band_t;
+
+// Which pins are lit along with those sharing a net with the pin under the
+// pointer
+typedef enum name_highlighting {
+    NAME_HIGHLIGHT_OFF = 0,
+    // Pins with the same name in the harness shown
+    NAME_HIGHLIGHT_HARNESS,
+    // Same, and the name stays lit in every harness until another pin is
+    // hovered
+    NAME_HIGHLIGHT_ALL,
+    N_NAME_HIGHLIGHT_MODES
+} name_highlighting_t;
+
+typedef struct pin_name_entry {
+    int harness;
+    int pin;
+} pin_name_entry_t;
+
+// Pins of every harness by name, built once the file is loaded; see
+// build_pin_name_index(). The pins named by string id s are entries
+// offsets[s] to offsets[s + 1], in harness and then pin id order.
+typedef struct pin_name_index {
+    uint32_t n_names;
+    int *offsets;
+    pin_name_entry_t *entries;
+} pin_name_index_t;
+
 typedef struct program_state {
     const char *harness_filename;
+    string_table_t strings;
     harness_description_t *harness_descriptions;
     harness_t *harnesses;
     int n_harnesses;
     int harness_index;
-    Font title_font;
-    Font connector_font;
+    // Index of the selected variant of the current harness, or -1 to show
+    // every variant
+    int variant_index;
+    Font fonts[N_FONTS];
+    float font_sizes[N_FONTS];
+    // Harnesses are laid out in world coordinates, with the first connector
+    // at the origin, and drawn through the camera. draw_offset is where the
+    // origin appears on screen.
+    Camera2D camera;
+    // In world coordinates
     Vector2 mouse_position;
     Vector2 draw_offset;
     int dark_background;
     Color foreground_color;
     Color background_color;
     float zoom_level;
+    // 0 stacks connectors in two columns by their reversed flag; otherwise
+    // they are packed into this many columns, balanced by height
+    int n_columns;
+    // Wires are drawn as orthogonal routes in the gaps instead of curves
+    int orthogonal;
+    view_state_t view;
+    uint32_t generation_counter;
     int n_pins_under_pointer;
-    connector_description_t *c1_under_pointer;
-    pin_t *p1_under_pointer;
-    connector_description_t *c2_under_pointer;
-    pin_t *p2_under_pointer;
+    handle_t p1_under_pointer;
+    handle_t p2_under_pointer;
     Vector2 wire_drawing_first_end;
     Vector2 wire_drawing_second_end;
+    // Wire edits and mirroring apply to the selection ahead of anything under
+    // the pointer
+    selection_t selection;
+    rubber_band_t band;
+    connector_drag_t drag;
+    name_highlighting_t name_highlighting;
+    // With NAME_HIGHLIGHT_ALL, the last name hovered stays lit while the
+    // pointer is elsewhere, e.g. after moving to another harness
+    string_id_t lit_name;
+    pin_name_index_t pin_names;
+    // Counts edits; see mark_harness_edited()
+    uint32_t revision;
+    edit_history_t history;
+    _Atomic(model_snapshot_t *) snapshot;
+    save_job_t save_job;
+    order_job_t order_job;
+    prefetch_job_t prefetch_job;
 
 } program_state_t;
 
-void create_connector(program_state_t *state, connector_t *c);
+void create_connector(program_state_t *state, harness_t *h, connector_t *c);
 void free_connector(connector_t *c);
-int draw_connector(program_state_t *state, connector_t *c, Vector2 position, int hidden);
+void draw_connector(program_state_t *state, connector_t *c);
 void draw_harness(program_state_t *state);
-float text_width(const char *str, Font font, int font_spacing);
-int update_max_string(char *max_str, const char *str);
+float text_width(const char *str, Font font, float font_size, int font_spacing);
+int format_typerow(program_state_t *state, const connector_description_t *cd, char *buf, size_t len);
+int format_pin_row(program_state_t *state, const connector_t *c, const pin_t *p, char *buf, size_t len);
 void parse_harness_description(program_state_t *state);
-int parse_harness_properties(char *harness_properties, harness_description_t *h);
-void parse_connector_header(char *header, connector_description_t *c);
-int parse_pin_entry(char *pin_entry, connector_description_t *c);
-int parse_wire_entry(char *wiring, harness_description_t *h);
-int pin_matches(wire_description_t *wd, connector_description_t *cd, pin_t *p);
+int parse_harness_properties(program_state_t *state, char *harness_properties, harness_description_t *h);
+void parse_connector_header(program_state_t *state, char *header, harness_description_t *h, connector_description_t *c);
+int parse_pin_entry(program_state_t *state, char *pin_entry, connector_description_t *c);
+int parse_wire_entry(program_state_t *state, char *wiring, harness_description_t *h);
 void free_connector_description(connector_description_t *t);
 void remove_newline(char *str);
 int create_harnesses(program_state_t *state);
 void free_harnesses(program_state_t *state);
 Color get_color_from_string(const char *str);
 int load_fonts(program_state_t *state);
-int draw_text(program_state_t *state, Font font, char *text, Vector2 position, int font_spacing, Color default_color, Color highlighed_color, int force_highlight, int hidden, int *is_under_pointer);
+int draw_text(program_state_t *state, Font font, const char *text, Vector2 position, Vector2 text_size, int font_spacing, Color default_color, Color highlighed_color, int force_highlight, int hidden, int *is_under_pointer);
 char *read_line(char *ln, size_t len, FILE *fp);
 void adjust_zoom(program_state_t *state, float amount);
 int generate_boilerplate_harness_description(const char *filename, harness_description_t *h);
 int export_harness_description(program_state_t *state);
-harness_description_t *make_harness_description_template(void);
-connector_description_t *add_connector_description(harness_description_t *h, const char *name, const char *type, const char *mate, int n_pins);
+int export_variant(program_state_t *state);
+void write_file_header(FILE *fp, int dark_background);
+int write_harness_description(FILE *fp, const string_table_t *strings, const harness_snapshot_t *hs, int harness_number, int variant);
+void write_variant_tags(FILE *fp, const string_table_t *strings, const harness_description_t *h, variant_mask_t variants);
+harness_description_t *make_harness_description_template(program_state_t *state);
+connector_description_t *add_connector_description(program_state_t *state, harness_description_t *h, const char *name, const char *type, const char *mate, int n_pins);
 void free_harness_descriptions(program_state_t *state);
 int export_template(int dark_background);
 void try_to_delete_wire(program_state_t *state);
@@ -192,10 +924,201 @@ void try_to_add_wire(program_state_t *state);
 void draw_pin_to_pointer(program_state_t *state);
 void reset_pin_under_pointer_states(program_state_t *state);
 void change_wire_colour(program_state_t *state, int direction);
-char *next_colour(const char *str);
-char *previous_colour(const char *str);
+const char *next_colour(const char *str);
+const char *previous_colour(const char *str);
 void change_wire_thickness(program_state_t *state, float delat_amount);
 void mirror_connector_lr(program_state_t *state);
+uint32_t hash_string(const char *str);
+char *string_arena_alloc(string_table_t *t, size_t len);
+int grow_string_slots(string_table_t *t);
+string_id_t intern_string(string_table_t *t, const char *str);
+const char *string_from_id(const string_table_t *t, string_id_t id);
+void free_string_table(string_table_t *t);
+const char **alloc_string_index(string_table_t *t, uint32_t max_strings);
+int reserve_wires(wire_table_t *t, int max_wires);
+int append_wire(wire_table_t *t, const wire_description_t *wd, uint32_t generation);
+void delete_wire(wire_table_t *t, int index);
+int compact_wires(wire_table_t *t, int *remap);
+void compact_harness_wires(program_state_t *state, harness_description_t *hd);
+wire_description_t get_wire(const wire_table_t *t, int index);
+int set_wire(wire_table_t *t, int index, const wire_description_t *wd);
+int endpoint_match_mask(const wire_table_t *t, endpoint_t e, int index);
+int find_wire_with_endpoint(const wire_table_t *t, endpoint_t e, int start);
+int find_last_wire_with_endpoint(const wire_table_t *t, endpoint_t e, int end);
+void free_wire_table(wire_table_t *t);
+int find_wire_override(const wire_table_t *t, int wire);
+int set_wire_override(wire_table_t *t, int wire, string_id_t gauge, string_id_t length);
+uint32_t next_generation(program_state_t *state);
+handle_t connector_handle(const harness_description_t *hd, int connector_index);
+connector_description_t *resolve_connector(harness_description_t *hd, handle_t h);
+handle_t pin_handle(const harness_description_t *hd, int connector_index, int pin_index);
+pin_t *resolve_pin(harness_description_t *hd, handle_t h, connector_description_t **cd);
+handle_t wire_handle(const wire_table_t *t, int index);
+int resolve_wire(const wire_table_t *t, handle_t h);
+handle_t remap_wire_handle(handle_t h, const int *remap);
+void index_harness_pins(harness_description_t *hd);
+int reserve_view_state(view_state_t *v, int n_pins, int n_wires);
+void clear_view_state(view_state_t *v, int n_pins, int n_wires);
+void free_view_state(view_state_t *v);
+int declare_variant(program_state_t *state, harness_description_t *h, const char *name);
+void parse_harness_variants(program_state_t *state, char *variants, harness_description_t *h);
+char *split_variant_tags(char *entry);
+variant_mask_t parse_variant_tags(program_state_t *state, harness_description_t *h, char *tags);
+variant_mask_t declared_variants(const harness_description_t *hd);
+variant_mask_t selected_variants(const program_state_t *state, const harness_description_t *hd);
+void select_next_variant(program_state_t *state);
+int wire_in_variants(const harness_description_t *hd, int index, variant_mask_t variants);
+int find_last_wire_in_variants(const harness_description_t *hd, endpoint_t e, variant_mask_t variants);
+int parse_splice_entry(program_state_t *state, char *entry, harness_description_t *h);
+int update_splice_graph(harness_description_t *hd);
+int splice_wire_keys(const void *context, int wire, int *keys);
+void free_splice_graph(splice_graph_t *g);
+int pin_anchor(program_state_t *state, harness_t *h, endpoint_t e, Vector2 *anchor);
+void layout_splices(program_state_t *state, harness_t *h, variant_mask_t variants);
+int find_splice_under_pointer(program_state_t *state, harness_t *h, variant_mask_t variants);
+void draw_splices(program_state_t *state, harness_t *h, variant_mask_t variants);
+void draw_splice_branch(program_state_t *state, harness_t *h, int wire);
+void draw_wire_spline(program_state_t *state, const wire_table_t *wires, int wire, const Vector2 *points);
+void write_endpoint(FILE *fp, int connector, int pin);
+int endpoint_vertex(const harness_description_t *hd, endpoint_t e);
+int nets_current(const harness_description_t *hd, variant_mask_t variants);
+int update_nets(harness_description_t *hd, variant_mask_t variants);
+int net_find(net_table_t *nets, int v);
+void net_union(net_table_t *nets, int a, int b);
+void add_wire_to_nets(harness_description_t *hd, int wire);
+void split_net(harness_description_t *hd, int v);
+int pin_net(harness_description_t *hd, int pin_id);
+void free_net_table(net_table_t *nets);
+void highlight_nets(program_state_t *state, harness_t *h, variant_mask_t variants);
+int update_vertex_wires(harness_description_t *hd);
+void free_vertex_wires(vertex_wires_t *vw);
+int add_lit_wire(lit_set_t *lit, int wire);
+int vertex_wire_keys(const void *context, int wire, int *keys);
+int update_lit_set(harness_t *h, const int *roots, int n_roots, variant_mask_t variants);
+void mark_harness_edited(program_state_t *state, harness_description_t *hd);
+wire_chunk_t *copy_wire_chunk(const wire_table_t *t, int chunk);
+harness_snapshot_t *snapshot_harness(const harness_description_t *hd, const harness_snapshot_t *previous);
+void release_harness_snapshot(harness_snapshot_t *hs);
+int publish_snapshot(program_state_t *state);
+model_snapshot_t *acquire_snapshot(program_state_t *state);
+void release_snapshot(model_snapshot_t *snap);
+void clear_snapshot_changes(harness_description_t *hd);
+void mark_connector_changed(harness_description_t *hd, int connector);
+wire_description_t get_snapshot_wire(const harness_snapshot_t *hs, int index);
+int snapshot_wire_in_variants(const harness_snapshot_t *hs, int index, variant_mask_t variants);
+int write_snapshot(const model_snapshot_t *snap, const char *filename, int harness, int variant);
+int start_save_job(program_state_t *state, const char *filename, int harness, int variant);
+void *run_save_job(void *arg);
+void poll_save_job(program_state_t *state);
+int finish_save_job(program_state_t *state);
+int order_connectors(const harness_snapshot_t *hs, variant_mask_t variants, const order_place_t *places, int *order);
+int order_layers(const harness_snapshot_t *hs, variant_mask_t variants, const order_place_t *places, int *layers, float *sum, int *count);
+float order_endpoint_row(const float *top, const float *splice_row, endpoint_t e);
+int order_endpoint_layer(const harness_snapshot_t *hs, const int *layers, endpoint_t e);
+void order_column(const harness_snapshot_t *hs, const int *layers, const int *live, int n_live, int layer, int *order, float *top, const float *splice_row, float *sum, int *count, order_key_t *keys);
+void place_order_rows(const harness_snapshot_t *hs, variant_mask_t variants, const order_place_t *places, const int *live, int n_live, const int *order, float *top, float *splice_row, int *count);
+long count_crossings(const harness_snapshot_t *hs, const int *layers, const int *live, int n_live, const float *top, const float *splice_row, order_edge_t *edges, float *scratch);
+long count_inversions(float *y, float *scratch, int n);
+int compare_order_edges(const void *a, const void *b);
+int compare_order_keys(const void *a, const void *b);
+int start_order_job(program_state_t *state);
+void *run_order_job(void *arg);
+void poll_order_job(program_state_t *state);
+void finish_order_job(program_state_t *state);
+int lay_out_harness(program_state_t *state, harness_t *h, variant_mask_t variants);
+int start_prefetch_job(program_state_t *state);
+void *run_prefetch_job(void *arg);
+void poll_prefetch_job(program_state_t *state);
+void finish_prefetch_job(program_state_t *state);
+int prepare_view_state(program_state_t *state);
+void invalidate_layout(program_state_t *state);
+void invalidate_connector_layout(program_state_t *state, int harness, int connector);
+void update_harness_layout(program_state_t *state, harness_t *h);
+int format_splice_label(program_state_t *state, const harness_description_t *hd, int splice, char *buf, size_t len);
+void place_connectors(program_state_t *state, harness_t *h, variant_mask_t variants);
+void update_camera(program_state_t *state);
+void assign_columns_by_side(harness_t *h);
+void assign_balanced_columns(harness_t *h, variant_mask_t variants, int n_columns);
+int choose_connector_sides(harness_t *h, variant_mask_t variants, int n_columns);
+void measure_left_pin_rows(program_state_t *state, harness_t *h, connector_t *c);
+void update_wired_pins(harness_t *h);
+void update_connector_rows(harness_t *h, connector_t *c);
+int connector_row_pin(const harness_t *h, const connector_t *c, int row);
+int format_hidden_pins_row(const connector_t *c, int row_pin, char *buf, size_t len);
+int find_connector_under_pointer(program_state_t *state, harness_t *h);
+int find_connectors_at(program_state_t *state, harness_t *h, Vector2 point, int *found, int max_found);
+int find_connector_at(program_state_t *state, harness_t *h, Vector2 point);
+int find_pin_at(program_state_t *state, harness_t *h, int connector, Vector2 point, Rectangle *row_box);
+void find_pins_under_pointer(program_state_t *state, harness_t *h);
+float segment_distance(Vector2 p, Vector2 a, Vector2 b);
+float wire_distance(const wire_curve_t *wc, int orthogonal, Vector2 p);
+int find_wire_at(program_state_t *state, harness_t *h, Vector2 point, float tolerance);
+void find_wire_under_pointer(program_state_t *state, harness_t *h);
+int picked_wire(program_state_t *state);
+int has_wire_to_edit(program_state_t *state, harness_description_t *hd, variant_mask_t variants);
+void remove_wire(program_state_t *state, harness_description_t *hd, int wire, variant_mask_t variants);
+void recolour_wire(program_state_t *state, harness_description_t *hd, int wire, int direction);
+void thicken_wire(program_state_t *state, harness_description_t *hd, int wire, float delta_amount);
+int reserve_selection(selection_t *s, int n_wires, int n_connectors);
+void clear_selection(program_state_t *state);
+int next_selected_wire(program_state_t *state, int start);
+int next_selected_connector(program_state_t *state, int start);
+void remap_selection(selection_t *s, const int *remap, int n_rows);
+void free_selection(program_state_t *state);
+void deselect_wire(program_state_t *state, int harness, int wire);
+void start_selection(program_state_t *state);
+void extend_rubber_band(program_state_t *state);
+Rectangle rubber_band_box(const rubber_band_t *b);
+int band_holds_point(const rubber_band_t *b, Rectangle box, Vector2 p);
+int band_holds_wire(const rubber_band_t *b, Rectangle box, const wire_curve_t *wc, int orthogonal);
+int finish_rubber_band(program_state_t *state);
+void draw_rubber_band(program_state_t *state);
+int build_pin_name_index(program_state_t *state);
+void free_pin_name_index(pin_name_index_t *index);
+void highlight_pin_names(program_state_t *state, harness_t *h);
+void cycle_name_highlighting(program_state_t *state);
+void cycle_pin_view(program_state_t *state);
+void scroll_pin_window(program_state_t *state, int rows);
+grid_cell_t *grid_cell(spatial_grid_t *g, int32_t x, int32_t y, int create);
+int grow_grid(spatial_grid_t *g);
+int reserve_grid_items(spatial_grid_t *g, int n_items);
+grid_span_t grid_span_of(Rectangle r);
+void grid_remove(spatial_grid_t *g, int item);
+void prune_grid_cell(spatial_grid_t *g, grid_cell_t *cell);
+int grid_insert(spatial_grid_t *g, int item, Rectangle r);
+int grid_query(spatial_grid_t *g, Rectangle r, int **items, int *n_items, int *max_items);
+void clear_grid(spatial_grid_t *g);
+void free_grid(spatial_grid_t *g);
+int update_wire_geometry(program_state_t *state, harness_t *h);
+int connector_wire_keys(const void *context, int wire, int *keys);
+int build_csr(int n_keys, int n_items, csr_keys_fn keys_of, const void *context, int *offsets, int **items, int *max_items);
+void update_wire_curve(program_state_t *state, harness_t *h, int wire);
+void route_wire(program_state_t *state, harness_t *h, int wire);
+void set_wire_bounds(harness_t *h, int wire);
+void refresh_wire_bounds(program_state_t *state, harness_description_t *hd, int wire);
+int assign_wire_tracks(harness_t *h);
+int compare_track_intervals(const void *a, const void *b);
+void push_track_end(track_end_t *heap, int *n, track_end_t t);
+track_end_t pop_track_end(track_end_t *heap, int *n);
+void move_connector(program_state_t *state, harness_t *h, int connector, Vector2 position);
+int find_visible_items(program_state_t *state, harness_t *h);
+int compare_ints(const void *a, const void *b);
+void start_connector_drag(program_state_t *state);
+void drag_connector(program_state_t *state);
+void finish_connector_drag(program_state_t *state);
+int revive_wire(wire_table_t *t, handle_t h);
+void begin_edit_step(program_state_t *state);
+int push_edit(edit_stack_t *s, const edit_t *e);
+void record_edit(program_state_t *state, const edit_t *e);
+void record_wire_presence(program_state_t *state, harness_description_t *hd, edit_kind_t kind, int wire);
+void record_wire_change(program_state_t *state, harness_description_t *hd, edit_kind_t kind, int wire, edit_value_t before, edit_value_t after);
+int apply_edit(program_state_t *state, edit_t *e, int undo);
+int replay_edit_step(program_state_t *state, edit_stack_t *from, edit_stack_t *to, int undo);
+int undo_edit_step(program_state_t *state);
+int redo_edit_step(program_state_t *state);
+void remap_edit_history(edit_history_t *history, int harness, const int *remap);
+void relink_wire_edits(edit_history_t *history, int harness, uint32_t generation, int row);
+void free_edit_history(edit_history_t *history);
 
 int main(int argc, char **argv)
 {
@@ -223,6 +1146,7 @@ int main(int argc, char **argv)
 
     program_state_t state = {0};
     state.zoom_level = 1.0;
+    state.variant_index = -1;
     state.harness_filename = argv[1];
     parse_harness_description(&state);
 
@@ -255,38 +1179,69 @@ int main(int argc, char **argv)
     GetMouseDelta();
 
     int export_status = 0;
-    int harness_status = 0;
+    int harness_status = create_harnesses(&state);
+    if (harness_status > 1) {
+        fprintf(stderr, "Unable to lay out harnesses.\n");
+        return EXIT_FAILURE;
+    }
 
     while (running) {
-        state.mouse_position = GetMousePosition();
-        (void)create_harnesses(&state);
+        update_camera(&state);
+        state.mouse_position = GetScreenToWorld2D(GetMousePosition(), state.camera);
+        (void)prepare_view_state(&state);
         BeginDrawing();
             ClearBackground(state.background_color);
-            draw_harness(&state);
+            BeginMode2D(state.camera);
+                draw_harness(&state);
+                if (IsMouseButtonDown(MOUSE_BUTTON_LEFT) && state.n_pins_under_pointer > 0) {
+                    draw_pin_to_pointer(&state);
+                }
+                if (state.band.active) {
+                    draw_rubber_band(&state);
+                }
+            EndMode2D();
         EndDrawing();
 
-        if (IsMouseButtonDown(MOUSE_BUTTON_LEFT) && state.n_pins_under_pointer > 0) {
-            draw_pin_to_pointer(&state);
-        } else if (IsMouseButtonReleased(MOUSE_BUTTON_LEFT) && state.n_pins_under_pointer == 2) {
+        if (IsMouseButtonReleased(MOUSE_BUTTON_LEFT) && state.n_pins_under_pointer == 2) {
             try_to_add_wire(&state);
             reset_pin_under_pointer_states(&state);
         } 
+        // Connectors are dragged by anything but a pin, and a press on
+        // anything else selects
+        if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
+            start_connector_drag(&state);
+            start_selection(&state);
+        } else if (state.drag.active && IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
+            drag_connector(&state);
+        } else if (state.band.active && IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
+            extend_rubber_band(&state);
+        }
+        if (state.drag.active && IsMouseButtonReleased(MOUSE_BUTTON_LEFT)) {
+            finish_connector_drag(&state);
+        }
+        if (state.band.active && IsMouseButtonReleased(MOUSE_BUTTON_LEFT)) {
+            if (finish_rubber_band(&state) != 0) {
+                fprintf(stderr, "Error selecting.\n");
+            }
+        }
+        float wheel = GetMouseWheelMove();
+        if (wheel != 0.0f) {
+            scroll_pin_window(&state, wheel > 0.0f ? -PIN_SCROLL_ROWS : PIN_SCROLL_ROWS);
+        }
         if (IsMouseButtonDown(MOUSE_BUTTON_RIGHT)) {
             Vector2 mouse_movement = GetMouseDelta();
             state.draw_offset.x += mouse_movement.x;
             state.draw_offset.y += mouse_movement.y;
         }
 
+        // Zooming and panning only move the camera
         if (IsKeyDown(KEY_MINUS))
         {
             adjust_zoom(&state, +ZOOM_RATE);
-            load_fonts(&state);
         } else if (IsKeyDown(KEY_EQUAL) && (IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT))) {
             adjust_zoom(&state, -ZOOM_RATE);
-            load_fonts(&state);
         } else if (IsKeyDown(KEY_ZERO)) {
             state.zoom_level = 1.0;
-            load_fonts(&state);
         }
         if (IsKeyDown(KEY_L)) {
             state.draw_offset.x -= 10;
@@ -322,21 +1277,47 @@ int main(int argc, char **argv)
                             fprintf(stderr, "Error exporting harness description template.\n");
                         }
                     } else {
+                        // The next harness may still be being laid out
+                        finish_prefetch_job(&state);
                         state.harness_index++;
                         if (state.harness_index >= state.n_harnesses) {
                             state.harness_index = state.n_harnesses - 1;
                         }
+                        state.variant_index = -1;
                     }
                     break;
                 case KEY_P:
+                        finish_prefetch_job(&state);
                         state.harness_index--;
                         if (state.harness_index < 0) {
                             state.harness_index = 0;
                         }
+                        state.variant_index = -1;
+                    break;
+                case KEY_V:
+                    select_next_variant(&state);
+                    break;
+                case KEY_E:
+                    if (IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL)) {
+                        export_status = export_variant(&state);
+                        if (export_status != 0) {
+                            fprintf(stderr, "Error exporting harness variant.\n");
+                        }
+                    }
                     break;
                 case KEY_D:
                     try_to_delete_wire(&state);
                     break;
+                case KEY_Z:
+                    if (IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL)) {
+                        undo_edit_step(&state);
+                    }
+                    break;
+                case KEY_Y:
+                    if (IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL)) {
+                        redo_edit_step(&state);
+                    }
+                    break;
                 case KEY_ONE:
                     change_wire_colour(&state, 0);
                     break;
@@ -352,19 +1333,55 @@ int main(int argc, char **argv)
                 case KEY_R:
                     mirror_connector_lr(&state);
                     break;
+                case KEY_C:
+                    finish_prefetch_job(&state);
+                    // Two columns by side, then 2 to MAX_COLUMNS balanced columns
+                    if (state.n_columns == 0) {
+                        state.n_columns = 2;
+                    } else if (state.n_columns >= MAX_COLUMNS) {
+                        state.n_columns = 0;
+                    } else {
+                        state.n_columns++;
+                    }
+                    break;
+                case KEY_X:
+                    cycle_pin_view(&state);
+                    break;
+                case KEY_G:
+                    cycle_name_highlighting(&state);
+                    break;
+                case KEY_O:
+                    finish_prefetch_job(&state);
+                    state.orthogonal = !state.orthogonal;
+                    break;
+                case KEY_A:
+                    if (start_order_job(&state) != 0) {
+                        fprintf(stderr, "Error ordering connectors.\n");
+                    }
+                    break;
                 default:
                     break;
             }
         }
-        free_harnesses(&state);
+        // Background jobs only ever see published snapshots
+        if (publish_snapshot(&state) != 0) {
+            fprintf(stderr, "Error publishing harness snapshot.\n");
+        }
+        poll_save_job(&state);
+        poll_order_job(&state);
+        poll_prefetch_job(&state);
+        if (start_prefetch_job(&state) != 0) {
+            fprintf(stderr, "Error preparing neighbouring harnesses.\n");
+        }
     }
 
+    free_harnesses(&state);
     free_harness_descriptions(&state);
 
     return 0;
 }
 
-void create_connector(program_state_t *state, connector_t *c)
+void create_connector(program_state_t *state, harness_t *h, connector_t *c)
 {
     if (c == NULL) {
         fprintf(stderr, "Invalid NULL pointer in call to create_connector\n");
@@ -372,18 +1389,56 @@ void create_connector(program_state_t *state, connector_t *c)
     }
 
     connector_description_t *cd = c->description;
-    c->font = state->connector_font;
-    c->line_height = c->font.baseSize + 2;
-    c->font_spacing = FONT_SPACING;
-    c->max_letters = update_max_string(c->max_str, cd->name);
-    snprintf(c->typerow, LINE_MAX_LEN, "%s %s (%d pins)", cd->type, cd->mate, cd->n_pins);
-    c->max_letters = update_max_string(c->max_str, c->typerow);
+    c->font = CONNECTOR_FONT;
+    Font font = state->fonts[c->font];
+    float font_size = state->font_sizes[c->font];
+    c->line_height = font_size + 2;
+
+    // The outline fits the longest of the name, the type row and the pin
+    // names; only that one string is measured.
+    char typerow[LINE_MAX_LEN] = {0};
+    const char *name = string_from_id(&state->strings, cd->name);
+    const char *max_str = name;
+    size_t max_len = strlen(name);
+    size_t len = format_typerow(state, cd, typerow, LINE_MAX_LEN);
+    if (len > max_len) {
+        max_str = typerow;
+        max_len = len;
+    }
+    const char *pin_name = NULL;
+    const char *max_pin_str = "";
+    size_t max_pin_len = 0;
     for (int i = 0; i < cd->n_pins; ++i) {
-        c->max_pin_letters = update_max_string(c->max_pin_str, cd->pins[i].name);
+        pin_name = string_from_id(&state->strings, cd->pins[i].name);
+        len = strlen(pin_name);
+        if (len > max_pin_len) {
+            max_pin_str = pin_name;
+            max_pin_len = len;
+        }
+    }
+    if (max_pin_len > max_len) {
+        max_str = max_pin_str;
     }
-    c->max_letters = update_max_string(c->max_str, c->max_pin_str);
-    c->outline.width = text_width(c->max_str, c->font, c->font_spacing) + CONNECTOR_OUTLINE_GAP * 2;
-    c->outline.height = c->line_height * (2 + cd->n_pins) + CONNECTOR_OUTLINE_GAP * 2;
+    c->max_pin_letters = (int16_t)max_pin_len;
+    c->name_width = text_width(name, font, font_size, FONT_SPACING);
+    c->typerow_width = text_width(typerow, font, font_size, FONT_SPACING);
+    c->pin_row_width = 0;
+    if (cd->n_pins > 0) {
+        char pin_row[LINE_MAX_LEN] = {0};
+        snprintf(pin_row, LINE_MAX_LEN, "%*s %3d", c->max_pin_letters, string_from_id(&state->strings, cd->pins[0].name), cd->pins[0].number);
+        c->pin_row_width = text_width(pin_row, font, font_size, FONT_SPACING);
+    }
+    c->outline.width = text_width(max_str, font, font_size, FONT_SPACING) + CONNECTOR_OUTLINE_GAP * 2;
+    update_connector_rows(h, c);
+    c->outline.height = c->line_height * (2 + c->n_rows) + CONNECTOR_OUTLINE_GAP * 2;
+
+    // Right-aligned rows are all padded to pin_row_width; left-aligned rows
+    // are measured when the connector is first placed facing left
+    c->left_rows_measured = 0;
+    if (c->facing_left) {
+        measure_left_pin_rows(state, h, c);
+    }
+    c->needs_layout = 0;
 
     return;
 }
@@ -393,110 +1448,68 @@ void free_connector(connector_t *c) {
     c = NULL;
 }
 
-int draw_connector(program_state_t *state, connector_t *c, Vector2 position, int hidden)
+// The connector must have been placed by place_connectors()
+void draw_connector(program_state_t *state, connector_t *c)
 {
-    c->outline.x = position.x;
-    c->outline.y = position.y;
-
-    int highlighting_updated = 0;
-
     connector_description_t *cd = c->description;
-    wire_description_t *wd = NULL;
     pin_t *p = NULL;
-    harness_description_t *hd = &state->harness_descriptions[state->harness_index];
-    int n_wires = hd->n_wire_descriptions;
+    harness_t *h = &state->harnesses[state->harness_index];
+    view_state_t *view = &state->view;
+    int pin_id = 0;
+    int pin_highlighted = 0;
 
+    Font font = state->fonts[c->font];
+    float font_size = state->font_sizes[c->font];
+    const char *connector_name = string_from_id(&state->strings, cd->name);
     int yoff = c->outline.y + CONNECTOR_OUTLINE_GAP;
-    int xoff = c->outline.x + c->outline.width / 2 - text_width(cd->name, c->font, c->font_spacing) / 2;
-    int xoff1 = 0;
-    int yoff1 = 0;
+    int xoff = c->outline.x + c->outline.width / 2 - c->name_width / 2;
     Color highlighted_color = get_color_from_string(DEFAULT_HIGHLIGHT_COLOR);
     float line_thickness = 1.5;
+    Color outline_color = state->foreground_color;
     c->is_highlighted = CheckCollisionPointRec(state->mouse_position, c->outline);
     if (c->is_highlighted) {
         line_thickness += 1.0;
     }
-    if (!hidden) {
-        DrawRectangleRoundedLinesEx(c->outline, 0.1, 1, line_thickness * state->connector_font.baseSize / FONT_SIZE, state->foreground_color);
+    int index = (int)(c - h->connectors);
+    if (state->selection.harness == state->harness_index && index < state->selection.max_connector_words * 64 && BITSET_TEST(state->selection.connectors, index)) {
+        outline_color = highlighted_color;
+        line_thickness += 1.0;
     }
-    draw_text(state, c->font, cd->name, (Vector2){xoff, yoff}, c->font_spacing, state->foreground_color, state->foreground_color, 0, hidden, NULL);
+    DrawRectangleRoundedLinesEx(c->outline, 0.1, 1, line_thickness, outline_color);
+    draw_text(state, font, connector_name, (Vector2){xoff, yoff}, (Vector2){c->name_width, font_size}, FONT_SPACING, state->foreground_color, state->foreground_color, 0, 0, NULL);
 
 
-    int old_highlighting = 0;
+    char line[LINE_MAX_LEN] = {0};
     yoff += c->line_height;
-    xoff = c->outline.x + c->outline.width / 2 - text_width(c->typerow, c->font, c->font_spacing) / 2;
-    if (!hidden) {
-        DrawTextEx(c->font, c->typerow, (Vector2){xoff, yoff}, c->font.baseSize, FONT_SPACING, state->foreground_color);
-    }
+    xoff = c->outline.x + c->outline.width / 2 - c->typerow_width / 2;
+    format_typerow(state, cd, line, LINE_MAX_LEN);
+    DrawTextEx(font, line, (Vector2){xoff, yoff}, font_size, FONT_SPACING, state->foreground_color);
 
-    char pin_line[LINE_MAX_LEN] = {0};
-    if (cd->mirror_lr) {
-        snprintf(c->pin_format, 64, "%%3d %%s");
-        snprintf(pin_line, LINE_MAX_LEN, c->pin_format, cd->pins[0].number, cd->pins[0].name);
+    if (c->facing_left) {
         xoff = c->outline.x + CONNECTOR_OUTLINE_GAP;
     } else {
-        snprintf(c->pin_format, 64, "%%%ds %%3d", c->max_pin_letters);
-        snprintf(pin_line, LINE_MAX_LEN, c->pin_format, cd->pins[0].name, cd->pins[0].number);
-        xoff = c->outline.x + c->outline.width - CONNECTOR_OUTLINE_GAP - text_width(pin_line, c->font, c->font_spacing);
+        xoff = c->outline.x + c->outline.width - CONNECTOR_OUTLINE_GAP - c->pin_row_width;
     }
-    for (int i = 0; i < cd->n_pins; ++i) {
-        p = &cd->pins[i];
+    // Only the rows shown are formatted
+    int i = 0;
+    for (int row = 0; row < c->n_rows; ++row) {
         yoff += c->line_height;
-        if (cd->mirror_lr) {
-            snprintf(pin_line, LINE_MAX_LEN, c->pin_format, p->number, p->name);
-        } else {
-            snprintf(pin_line, LINE_MAX_LEN, c->pin_format, p->name, p->number);
-        }
-        // Check if pin's wire is highlighted
-        old_highlighting = p->is_highlighted;
-        for (int k = 0; k < n_wires; ++k) {
-            wd = &hd->wire_descriptions[k];
-            if (!p->is_highlighted && ((wd->c1 == cd->number && wd->c1_pin == p->number) || (wd->c2 == cd->number && wd->c2_pin == p->number))) {
-                if (wd->is_highlighted) {
-                    p->is_highlighted = 1;
-                }
-            }
-        }
-        Vector2 pin_line_size = MeasureTextEx(c->font, pin_line, c->font.baseSize, c->font_spacing);
-        p->is_highlighted = draw_text(state, c->font, pin_line, (Vector2){xoff, yoff}, c->font_spacing, state->foreground_color, highlighted_color, p->is_highlighted, hidden, &p->is_under_pointer);
-        if (IsMouseButtonDown(MOUSE_BUTTON_LEFT) && p->is_under_pointer) {
-            xoff1 = xoff;
-            if (!cd->mirror_lr)  {
-                xoff1 += pin_line_size.x;
-            }
-            yoff1 = yoff + pin_line_size.y / 2.0;
-            if (state->n_pins_under_pointer == 0) {
-                state->wire_drawing_first_end = (Vector2){xoff1, yoff1};
-                state->c1_under_pointer = cd;
-                state->p1_under_pointer = p;
-                state->n_pins_under_pointer = 1;
-            } else if (state->n_pins_under_pointer == 1 && p != state->p1_under_pointer) {
-                state->wire_drawing_second_end = (Vector2){xoff1, yoff1};
-                state->c2_under_pointer = cd;
-                state->p2_under_pointer = p;
-                state->n_pins_under_pointer = 2;
-            } else if (state->n_pins_under_pointer == 2 && p != state->p2_under_pointer) {
-                state->wire_drawing_second_end = (Vector2){xoff1, yoff1};
-                state->c2_under_pointer = cd;
-                state->p2_under_pointer = p;
-            }
-        }
-        if (p->is_highlighted != old_highlighting) {
-            highlighting_updated = 1;
-        }
-        // highlight its wire and the target connector's pin 
-        if (p->is_highlighted) {
-            for (int k = 0; k < n_wires; ++k) {
-                wd = &hd->wire_descriptions[k];
-                if (!wd->is_highlighted && ((wd->c1 == cd->number && wd->c1_pin == p->number) || (wd->c2 == cd->number && wd->c2_pin == p->number))) {
-                    wd->is_highlighted = 1;
-                    highlighting_updated = 1;
-                }
+        i = connector_row_pin(h, c, row);
+        if (i < 0) {
+            if (format_hidden_pins_row(c, i, line, LINE_MAX_LEN) > 0) {
+                DrawTextEx(font, line, (Vector2){xoff, yoff}, font_size, FONT_SPACING, state->foreground_color);
             }
+            continue;
         }
+        p = &cd->pins[i];
+        format_pin_row(state, c, p, line, LINE_MAX_LEN);
+        // Pins under the pointer and on a lit net were marked by
+        // find_pins_under_pointer() and highlight_nets()
+        pin_id = cd->first_pin + i;
+        pin_highlighted = BITSET_TEST(view->pin_highlighted, pin_id);
+        Vector2 pin_line_size = {c->facing_left ? h->pin_widths[pin_id] : c->pin_row_width, font_size};
+        draw_text(state, font, line, (Vector2){xoff, yoff}, pin_line_size, FONT_SPACING, state->foreground_color, highlighted_color, pin_highlighted, 0, NULL);
     }
-
-    return highlighting_updated;
 }
 
 void draw_harness(program_state_t *state)
@@ -512,142 +1525,97 @@ void draw_harness(program_state_t *state)
         return;
     }
 
-    // Draw all non-mirrored connectors at the same x position, same for mirrored connectors
-    Vector2 connector_pos_left = {0};
-    Vector2 connector_pos_right = {0};
-    int max_width = 0;
-    connector_t *c = NULL;
-    // Prepare harnesses to capture pin highlighting by mouse
-    int highlighting_updated = 0;
-    int highlighting_completed = 0;
-    int iter = 0;
-    while (highlighting_completed == 0) {
-        highlighting_updated = 0;
-        connector_pos_left = state->draw_offset;
-        for (int i = 0; i < h->n_connectors; ++i) {
-            c = &h->connectors[i];
-            if (!c->description->mirror_lr) {
-                highlighting_updated += draw_connector(state, c, connector_pos_left, 1);
-                if (c->outline.width > max_width) {
-                    max_width = c->outline.width;
-                }
-                connector_pos_left.y += c->outline.height + CONNECTOR_SPACING_Y;
-            }
-        }
-        connector_pos_right = (Vector2){connector_pos_left.x + max_width + (float)CONNECTOR_SPACING_X * state->zoom_level, state->draw_offset.y};
-        for (int i = 0; i < h->n_connectors; ++i) {
-            c = &h->connectors[i];
-            if (c->description->mirror_lr) {
-                highlighting_updated += draw_connector(state, c, connector_pos_right, 1);
-                connector_pos_right.y += c->outline.height + CONNECTOR_SPACING_Y;
-            }
-        }
-        // Prepare harness right side to capture highlighting
-        if (highlighting_updated == 0) {
-            highlighting_completed = 1;
-        }
+    // Connectors and wires outside the selected variant are skipped
+    variant_mask_t variants = selected_variants(state, h->description);
+    (void)update_splice_graph(h->description);
+    if (lay_out_harness(state, h, variants) != 0 || find_visible_items(state, h) != 0) {
+        return;
     }
-    // Draw harness left side
-    connector_pos_left = state->draw_offset;
-    for (int i = 0; i < h->n_connectors; ++i) {
-        c = &h->connectors[i];
-        if (!c->description->mirror_lr) {
-            draw_connector(state, c, connector_pos_left, 0);
-            connector_pos_left.y += c->outline.height + CONNECTOR_SPACING_Y;
-        }
+
+    // Only what is in view is hovered and drawn. Connectors come first in
+    // the visible list, then wires, each in index order.
+    connector_t *c = NULL;
+    int n_connectors_visible = 0;
+    while (n_connectors_visible < h->n_visible && h->visible[n_connectors_visible] < h->n_connectors) {
+        n_connectors_visible++;
     }
-    // Draw harness right side
-    connector_pos_right = (Vector2){connector_pos_left.x + max_width + (float)CONNECTOR_SPACING_X * state->zoom_level, state->draw_offset.y};
-    for (int i = 0; i < h->n_connectors; ++i) {
-        c = &h->connectors[i];
-        if (c->description->mirror_lr) {
-            draw_connector(state, c, connector_pos_right, 0);
-            connector_pos_right.y += c->outline.height + CONNECTOR_SPACING_Y;
+    find_pins_under_pointer(state, h);
+    layout_splices(state, h, variants);
+    // Light everything on the same net as what is under the pointer
+    highlight_nets(state, h, variants);
+    highlight_pin_names(state, h);
+    find_wire_under_pointer(state, h);
+    for (int i = 0; i < n_connectors_visible; ++i) {
+        c = &h->connectors[h->visible[i]];
+        if (c->description->variants & variants) {
+            draw_connector(state, c);
         }
     }
 
-    float dx = 0.0;
-    int i_left = 0;
-    int i_right = 0;
-    float y_left = 0.0;
-    float y_right = 0.0;
-
     harness_description_t *hd = h->description;
-    connector_t *cleft = NULL;
-    connector_t *cright = NULL;
-    wire_description_t *wd = NULL;
-    int cleft_index = 0;
-    int cright_index = 0;
-    int pleft_index = 0;
-    int pright_index = 0;
-    for (int i = 0; i < hd->n_wire_descriptions; ++i) {
-        wd = &hd->wire_descriptions[i];
-        cleft_index = wd->c1 - 1;
-        if (cleft_index < 0 || cleft_index >= h->n_connectors) {
-            fprintf(stderr, "Invalid source connector number for wire %d\n", i + 1);
-            continue;
-        }
-        cright_index = wd->c2 - 1;
-        if (cright_index < 0 || cright_index >= h->n_connectors) {
-            fprintf(stderr, "Invalid target connector number for wire %d\n", i + 1);
+    wire_table_t *wires = &hd->wires;
+    int wire = 0;
+    for (int i = n_connectors_visible; i < h->n_visible; ++i) {
+        wire = h->visible[i] - h->n_connectors;
+        if (WIRE_IS_DEAD(wires, wire) || !wire_in_variants(hd, wire, variants)) {
             continue;
         }
-        cleft = &h->connectors[cleft_index];
-        cright = &h->connectors[cright_index];
-
-        float y0_left = cleft->outline.y + CONNECTOR_OUTLINE_GAP + cleft->font.baseSize * 1.5;
-        float y0_right = cright->outline.y + CONNECTOR_OUTLINE_GAP + cright->font.baseSize * 1.5;
-
-        float x_left = cleft->outline.x;
-        if (!cleft->description->mirror_lr) {
-            x_left += cleft->outline.width;
-        }
-        float x_right = cright->outline.x;
-        if (!cright->description->mirror_lr) {
-            x_right += cright->outline.width;
-        }
-        i_left = wd->c1_pin;
-        i_right = wd->c2_pin;
-        y_left = y0_left + (float)(i_left * cleft->line_height);
-        y_right = y0_right + (float)(i_right * cright->line_height);
-        dx = wd->straight_fraction * (float)CONNECTOR_SPACING_X * state->zoom_level;
-        Vector2 points[] = {{x_left, y_left}, {x_left + dx, y_left}, {x_right - dx, y_right}, {x_right, y_right}};
-        if (x_right == x_left) {
-            // Pins are on the same end of the harness
-            if (cleft->description->mirror_lr) {
-                points[1].x -= 2 * dx;
-            } else {
-                points[2].x += 2 * dx;
+        draw_wire_spline(state, wires, wire, h->curves[wire].points);
+    }
+    // Splice branches follow the splices, which are laid out every frame
+    splice_graph_t *g = &hd->splice_graph;
+    for (int s = 0; g->offsets != NULL && s < g->n_splices; ++s) {
+        for (int k = g->offsets[s]; k < g->offsets[s + 1]; ++k) {
+            wire = g->wires[k];
+            // A wire between two splices is drawn from its first end only
+            if (ENDPOINT_IS_SPLICE(wires->end1[wire]) && ENDPOINT_PIN(wires->end1[wire]) - 1 != s) {
+                continue;
+            }
+            if (!WIRE_IS_DEAD(wires, wire) && wire_in_variants(hd, wire, variants)) {
+                draw_splice_branch(state, h, wire);
             }
         }
-        Color outline_wire_color = state->foreground_color;
-        float outline_wire_thickness = wd->thickness + 0.5;
-        // Draw wire
-        if (wd->is_highlighted) {
-            outline_wire_color = get_color_from_string(DEFAULT_HIGHLIGHT_COLOR);
-            outline_wire_thickness = wd->thickness + 4;
-        }
-        DrawSplineBezierCubic(points, 4, outline_wire_thickness * state->zoom_level, outline_wire_color);
-        DrawSplineBezierCubic(points, 4, wd->thickness * state->zoom_level, get_color_from_string(wd->colour));
     }
+    draw_splices(state, h, variants);
 
-    Vector2 title_size = MeasureTextEx(h->title_font, h->description->name, h->title_font.baseSize, h->title_font_spacing);
-    DrawTextEx(h->title_font, h->description->name, (Vector2){state->draw_offset.x, state->draw_offset.y - title_size.y - 5}, h->title_font.baseSize, h->title_font_spacing, BLACK); 
+    char title[LINE_MAX_LEN] = {0};
+    if (variants != ALL_VARIANTS) {
+        snprintf(title, LINE_MAX_LEN, "%s [%s]", string_from_id(&state->strings, hd->name), string_from_id(&state->strings, hd->variant_names[state->variant_index]));
+    } else {
+        snprintf(title, LINE_MAX_LEN, "%s", string_from_id(&state->strings, hd->name));
+    }
+    Font title_font = state->fonts[h->title_font];
+    float title_size = state->font_sizes[h->title_font];
+    DrawTextEx(title_font, title, (Vector2){0, -title_size - 5}, title_size, FONT_SPACING, BLACK); 
+
+}
 
+float text_width(const char *str, Font font, float font_size, int font_spacing)
+{
+    return MeasureTextEx(font, str, font_size, font_spacing).x;
 }
 
-float text_width(const char *str, Font font, int font_spacing)
+int format_typerow(program_state_t *state, const connector_description_t *cd, char *buf, size_t len)
 {
-    return MeasureTextEx(font, str, font.baseSize, font_spacing).x;
+    int n = snprintf(buf, len, "%s %s (%d pins)", string_from_id(&state->strings, cd->type), string_from_id(&state->strings, cd->mate), cd->n_pins);
+    if (n < 0) {
+        return 0;
+    }
+    if ((size_t)n >= len) {
+        n = (int)len - 1;
+    }
+
+    return n;
 }
 
-int update_max_string(char *max_str, const char *str)
+// Right-aligned rows pad the names to the connector's longest pin name
+int format_pin_row(program_state_t *state, const connector_t *c, const pin_t *p, char *buf, size_t len)
 {
-    if (strlen(str) > strlen(max_str)) {
-        snprintf(max_str, LINE_MAX_LEN, "%s", str);
+    if (c->facing_left) {
+        return snprintf(buf, len, "%3d %s", p->number, string_from_id(&state->strings, p->name));
     }
 
-    return (int)strlen(max_str);
+    return snprintf(buf, len, "%*s %3d", c->max_pin_letters, string_from_id(&state->strings, p->name), p->number);
 }
 
 void parse_harness_description(program_state_t *state)
@@ -666,7 +1634,6 @@ void parse_harness_description(program_state_t *state)
     harness_description_t *h = NULL;
 
     connector_description_t *cd = NULL;
-    wire_description_t *wd = NULL;
 
     // ignores comments
     while ((read_line(ln, FILE_LINE_MAX_LEN, fp)) != NULL) {
@@ -683,12 +1650,18 @@ void parse_harness_description(program_state_t *state)
             state->n_harnesses++;
             h = &state->harness_descriptions[state->n_harnesses - 1];
             memset(h, 0, sizeof *h);
-            h->name = strdup(ln);
+            h->name = intern_string(&state->strings, ln);
             fgetsptr = read_line(ln, FILE_LINE_MAX_LEN, fp);
             if (fgetsptr != NULL) {
-                status = parse_harness_properties(ln, h);
+                status = parse_harness_properties(state, ln, h);
             }
+        } else if (strncmp("variants", ln, 8) == 0 && h != NULL) {
+            parse_harness_variants(state, ln + 8, h);
         } else if (strncmp("connector", ln, 9) == 0) {
+            if (h->n_connector_descriptions >= MAX_ENDPOINT_NUMBER) {
+                fprintf(stderr, "%s: too many connectors\n", string_from_id(&state->strings, h->name));
+                break;
+            }
             mem = realloc(h->connector_descriptions, sizeof *h->connector_descriptions * (h->n_connector_descriptions + 1));
             if (mem == NULL) {
                 fclose(fp);
@@ -700,16 +1673,18 @@ void parse_harness_description(program_state_t *state)
             cd = &h->connector_descriptions[h->n_connector_descriptions - 1];
             memset(cd, 0, sizeof *cd);
             cd->number = h->n_connector_descriptions;
+            cd->generation = next_generation(state);
+            cd->variants = ALL_VARIANTS;
             fgetsptr = read_line(ln, FILE_LINE_MAX_LEN, fp);
             if (fgetsptr != NULL) {
-                parse_connector_header(ln, cd);
+                parse_connector_header(state, ln, h, cd);
             }
             while ((read_line(ln, FILE_LINE_MAX_LEN, fp)) != NULL) {
                 if (ln[0] == '.') {
                     // End of pin list for this connector
                     break;
                 }
-                status = parse_pin_entry(ln, cd);
+                status = parse_pin_entry(state, ln, cd);
                 if (status != 0) {
                     break;
                 }
@@ -720,7 +1695,11 @@ void parse_harness_description(program_state_t *state)
                     // End of wiring table for this harness
                     break;
                 }
-                status = parse_wire_entry(ln, h);
+                if (strncmp("splice", ln, 6) == 0) {
+                    status = parse_splice_entry(state, ln + 6, h);
+                } else {
+                    status = parse_wire_entry(state, ln, h);
+                }
                 if (status != 0) {
                     break;
                 }
@@ -730,67 +1709,90 @@ void parse_harness_description(program_state_t *state)
 
     fclose(fp);
 
+    for (int i = 0; i < state->n_harnesses; ++i) {
+        index_harness_pins(&state->harness_descriptions[i]);
+        (void)update_nets(&state->harness_descriptions[i], ALL_VARIANTS);
+    }
+    (void)build_pin_name_index(state);
+
     return;
 
 }
 
-int parse_harness_properties(char *harness_properties, harness_description_t *h)
+int parse_harness_properties(program_state_t *state, char *harness_properties, harness_description_t *h)
 {
     char *token, *string, *tofree;
     tofree = string = strdup(harness_properties);
 
-    void *mem = NULL;
+    const char *harness_name = string_from_id(&state->strings, h->name);
     token = strsep(&string, ",");
     if (token == NULL) {
-        fprintf(stderr, "%s: expected <default_wire_length>,<default_wire_gauge>,<default_wire_colour>\n", h->name);
+        fprintf(stderr, "%s: expected <default_wire_length>,<default_wire_gauge>,<default_wire_colour>\n", harness_name);
+        free(tofree);
         return 1;
     }
-    h->default_wire_length = strdup(token);
+    h->default_wire_length = intern_string(&state->strings, token);
     token = strsep(&string, ",");
     if (token == NULL || strlen(token) == 0) {
-        fprintf(stderr, "%s: missing <default_wire_gauge>\n", h->name);
+        fprintf(stderr, "%s: missing <default_wire_gauge>\n", harness_name);
+        free(tofree);
         return 1;
     }
-    h->default_wire_gauge = strdup(token);
+    h->default_wire_gauge = intern_string(&state->strings, token);
     token = strsep(&string, ",");
     if (token == NULL || strlen(token) == 0) {
-        fprintf(stderr, "%s: missing <default_wire_colour>\n", h->name);
+        fprintf(stderr, "%s: missing <default_wire_colour>\n", harness_name);
+        free(tofree);
         return 1;
     }
-    h->default_wire_colour = strdup(token);
+    h->default_wire_colour = intern_string(&state->strings, token);
 
     free(tofree);
 
     return 0;
 }
 
-void parse_connector_header(char *header, connector_description_t *c)
+void parse_connector_header(program_state_t *state, char *header, harness_description_t *h, connector_description_t *c)
 {
     char *token, *string, *tofree;
     tofree = string = strdup(header);
 
+    char *tags = split_variant_tags(string);
+    c->variants = ALL_VARIANTS;
+    if (tags != NULL) {
+        c->variants = parse_variant_tags(state, h, tags);
+    }
+
     token = strsep(&string, ",");
     if (token != NULL) {
-        c->name = strdup(token);
+        c->name = intern_string(&state->strings, token);
     }
     token = strsep(&string, ",");
     if (token != NULL) {
-        c->type = strdup(token);
+        c->type = intern_string(&state->strings, token);
     }
     token = strsep(&string, ",");
     if (token != NULL) {
-        c->mate = strdup(token);
+        c->mate = intern_string(&state->strings, token);
     }
     c->mirror_lr = 0;
-    token = strsep(&string, ",");
-    if (token != NULL && strcmp("reversed", token) == 0) {
-        c->mirror_lr = 1;
+    c->placed = 0;
+    while ((token = strsep(&string, ",")) != NULL) {
+        if (strcmp("reversed", token) == 0) {
+            c->mirror_lr = 1;
+        } else if (strncmp("at=", token, 3) == 0) {
+            if (sscanf(token + 3, "%f:%f", &c->x, &c->y) == 2) {
+                c->placed = 1;
+            } else {
+                fprintf(stderr, "%s has an invalid position '%s'\n", string_from_id(&state->strings, c->name), token);
+            }
+        }
     }
 
     free(tofree);
 }
 
-int parse_pin_entry(char *pin_entry, connector_description_t *c)
+int parse_pin_entry(program_state_t *state, char *pin_entry, connector_description_t *c)
 {
     char *token, *string, *tofree;
     tofree = string = strdup(pin_entry);
@@ -799,117 +1801,143 @@ int parse_pin_entry(char *pin_entry, connector_description_t *c)
     pin_t *p = NULL;
     token = strsep(&string, " ");
     if (token == NULL) {
-        fprintf(stderr, "%s invalid entry for pin %d\n", c->name, c->n_pins + 1);
+        fprintf(stderr, "%s invalid entry for pin %d\n", string_from_id(&state->strings, c->name), c->n_pins + 1);
+        free(tofree);
+        return 1;
+    }
+    if (c->n_pins >= MAX_ENDPOINT_NUMBER) {
+        fprintf(stderr, "%s has too many pins\n", string_from_id(&state->strings, c->name));
+        free(tofree);
         return 1;
     }
 
     mem = realloc(c->pins, sizeof *c->pins * (c->n_pins + 1));
     if (mem == NULL) {
         fprintf(stderr, "Error allocating memory\n");
+        free(tofree);
         return 2;
     }
     c->pins = mem;
     c->n_pins++;
+    c->generation = next_generation(state);
     p = &c->pins[c->n_pins-1];
     memset(p, 0, sizeof *p);
     p->number = atoi(token);
 
     if (string == NULL || strlen(string) == 0) {
-        fprintf(stderr, "%s missing name for pin %d\n", c->name, p->number);
+        fprintf(stderr, "%s missing name for pin %d\n", string_from_id(&state->strings, c->name), p->number);
+        free(tofree);
         return 1;
     }
-    p->name = strdup(string);
+    p->name = intern_string(&state->strings, string);
 
     free(tofree);
 
     return 0;
 }
 
-int parse_wire_entry(char *wiring, harness_description_t *h)
+int parse_wire_entry(program_state_t *state, char *wiring, harness_description_t *h)
 {
     char *token, *string, *tofree;
     tofree = string = strdup(wiring);
+    char *tags = split_variant_tags(string);
 
-    void *mem = NULL;
-    wire_description_t *w = NULL;
-    token = strsep(&string, ",");
-    if (token == NULL) {
-        fprintf(stderr, "%s: invalid wire entry %s\n", h->name, wiring);
-        return 1;
-    }
-
-    mem = realloc(h->wire_descriptions, sizeof *h->wire_descriptions * (h->n_wire_descriptions + 1));
-    if (mem == NULL) {
-        fprintf(stderr, "Error allocating memory\n");
-        return 2;
-    }
-    h->wire_descriptions = mem;
-    h->n_wire_descriptions++;
-    w = &h->wire_descriptions[h->n_wire_descriptions - 1];
-    memset(w, 0, sizeof *w);
+    wire_description_t wd = {0};
+    wire_description_t *w = &wd;
+    const char *harness_name = string_from_id(&state->strings, h->name);
+    int *connectors[] = {&w->c1, &w->c2};
+    int *pins[] = {&w->c1_pin, &w->c2_pin};
 
     w->colour = h->default_wire_colour;
     w->thickness = DEFAULT_WIRE_THICKNESS;
     w->straight_fraction = DEFAULT_WIRE_STRAIGHT_FRACTION;
-    w->length = h->default_wire_length;
-    w->gauge = h->default_wire_gauge;
+    w->variants = ALL_VARIANTS;
+    if (tags != NULL) {
+        w->variants = parse_variant_tags(state, h, tags);
+    }
 
-    w->c1 = atoi(token);
-    token = strsep(&string, ",");
-    if (token == NULL) {
-        fprintf(stderr, "%s: invalid wire entry %s\n", h->name, wiring);
-        return 1;
+    // Each end is either <conn_#>,<pin_#> or a declared splice S<n>
+    for (int i = 0; i < 2; ++i) {
+        token = strsep(&string, ",");
+        if (token == NULL) {
+            fprintf(stderr, "%s: invalid wire entry %s\n", harness_name, wiring);
+            free(tofree);
+            return 1;
+        }
+        if (token[0] == 'S') {
+            *connectors[i] = SPLICE_CONNECTOR;
+            *pins[i] = atoi(token + 1);
+            if (*pins[i] < 1 || *pins[i] > h->n_splices) {
+                fprintf(stderr, "%s: undeclared splice in wire entry %s\n", harness_name, wiring);
+                free(tofree);
+                return 1;
+            }
+            continue;
+        }
+        // Connector 0 stands for a splice (SPLICE_CONNECTOR), so numbers start at 1
+        *connectors[i] = atoi(token);
+        token = strsep(&string, ",");
+        if (token == NULL) {
+            fprintf(stderr, "%s: invalid wire entry %s\n", harness_name, wiring);
+            free(tofree);
+            return 1;
+        }
+        *pins[i] = atoi(token);
+        if (*connectors[i] < 1 || *connectors[i] > MAX_ENDPOINT_NUMBER || *pins[i] < 0 || *pins[i] > MAX_ENDPOINT_NUMBER) {
+            fprintf(stderr, "%s: connector or pin number out of range in wire entry %s\n", harness_name, wiring);
+            free(tofree);
+            return 1;
+        }
     }
-    w->c1_pin = atoi(token);
 
+    // Optional fields may be left empty to keep the default
     token = strsep(&string, ",");
-    if (token == NULL) {
-        fprintf(stderr, "%s: invalid wire entry %s\n", h->name, wiring);
-        return 1;
+    if (token != NULL && strlen(token) > 0) {
+        w->colour = intern_string(&state->strings, token);
     }
-    w->c2 = atoi(token);
 
     token = strsep(&string, ",");
-    if (token == NULL) {
-        fprintf(stderr, "%s: invalid wire entry %s\n", h->name, wiring);
-        return 1;
+    if (token != NULL && strlen(token) > 0) {
+        w->thickness = atof(token);
+        if (w->thickness < 0 || w->thickness > 20) {
+            fprintf(stderr, "Invalid wire thickness %f\n", w->thickness);
+            w->thickness = DEFAULT_WIRE_THICKNESS;
+        }
     }
-    w->c2_pin = atoi(token);
 
     token = strsep(&string, ",");
-    if (token != NULL) {
-        w->colour = strdup(token);
+    if (token != NULL && strlen(token) > 0) {
+        w->gauge = intern_string(&state->strings, token);
+        if (w->gauge == h->default_wire_gauge) {
+            w->gauge = 0;
+        }
     }
 
     token = strsep(&string, ",");
-    if (token != NULL) {
-        w->thickness = atof(token);
-        if (w->thickness < 0 || w->thickness > 20) {
-            fprintf(stderr, "Invalid wire thickness %f\n", w->thickness);
-            w->thickness = DEFAULT_WIRE_THICKNESS;
+    if (token != NULL && strlen(token) > 0) {
+        w->length = intern_string(&state->strings, token);
+        if (w->length == h->default_wire_length) {
+            w->length = 0;
         }
     }
 
     free(tofree);
 
+    if (append_wire(&h->wires, w, next_generation(state)) < 0) {
+        return 2;
+    }
+
     return 0;
 }
 
-int pin_matches(wire_description_t *wd, connector_description_t *cd, pin_t *p)
-{
-    return ((cd->number == wd->c1 && p->number == wd->c1_pin) || (cd->number == wd->c2 && p->number == wd->c2_pin)) ;
-}
+
 
 void free_connector_description(connector_description_t *t)
 {
-    free(t->name);
-    free(t->type);
-    free(t->mate);
-    pin_t *p = NULL;
-    for (int i = 0; i < t->n_pins; ++i) {
-        p = &t->pins[i];
-        free(p->name);
-    }
+    // Names are owned by the string table
+    free(t->pins);
+    t->pins = NULL;
+    t->n_pins = 0;
 }
 
 void remove_newline(char *str)
@@ -927,6 +1955,8 @@ void remove_newline(char *str)
 
 }
 
+// Allocates the layout of every harness. Sizes are measured when a harness is
+// first drawn, and again only where they have been invalidated.
 int create_harnesses(program_state_t *state)
 {
     if (state == NULL || state->n_harnesses == 0) {
@@ -942,8 +1972,7 @@ int create_harnesses(program_state_t *state)
     harness_t *h = NULL;
     for (int i = 0; i < state->n_harnesses; ++i) {
         h = &state->harnesses[i];
-        h->title_font_spacing = FONT_SPACING;
-        h->title_font = state->title_font;
+        h->title_font = TITLE_FONT;
         h->description = &state->harness_descriptions[i];
         h->n_connectors = h->description->n_connector_descriptions;
         h->connectors = malloc(sizeof *h->connectors * h->n_connectors);
@@ -952,35 +1981,57 @@ int create_harnesses(program_state_t *state)
             return 3;
         }
         memset(h->connectors, 0, sizeof *h->connectors * h->n_connectors);
-        connector_t *c = NULL;
+        h->splices = calloc(h->description->n_splices > 0 ? h->description->n_splices : 1, sizeof *h->splices);
+        h->pin_widths = calloc(h->description->n_pins > 0 ? h->description->n_pins : 1, sizeof *h->pin_widths);
+        h->order = malloc(sizeof *h->order * (h->n_connectors > 0 ? h->n_connectors : 1));
+        h->connector_wire_offsets = calloc(h->n_connectors + 1, sizeof *h->connector_wire_offsets);
+        h->row_pins = malloc(sizeof *h->row_pins * (h->description->n_pins > 0 ? h->description->n_pins : 1));
+        h->pin_rows = malloc(sizeof *h->pin_rows * (h->description->n_pins > 0 ? h->description->n_pins : 1));
+        h->pin_wired = calloc(BITSET_WORDS(h->description->n_pins > 0 ? h->description->n_pins : 1), sizeof *h->pin_wired);
+        h->pin_wired_version = h->description->wires.version - 1;
+        h->rows_wire_version = h->description->wires.version;
+        h->geometry_stale = 1;
+        if (h->splices == NULL || h->pin_widths == NULL || h->order == NULL || h->connector_wire_offsets == NULL || h->row_pins == NULL || h->pin_rows == NULL || h->pin_wired == NULL) {
+            fprintf(stderr, "Error allocating memory\n");
+            return 3;
+        }
         for (int i = 0; i < h->n_connectors; ++i) {
-            c = &h->connectors[i];
-            c->description = &h->description->connector_descriptions[i];
-            // reset pin highlighting
-            for (int k = 0; k < c->description->n_pins; ++k) {
-                c->description->pins[k].is_highlighted = 0;
+            h->connectors[i].description = &h->description->connector_descriptions[i];
+            if (h->connectors[i].description->n_pins > COLLAPSE_PIN_COUNT) {
+                h->connectors[i].pin_view = PIN_VIEW_WINDOW;
             }
-            create_connector(state, c);
-        }
-
-        // reset wire highlighting
-        for (int i = 0; i < h->description->n_wire_descriptions; ++i) {
-            h->description->wire_descriptions[i].is_highlighted = 0;
+            // File order until reordered
+            h->order[i] = i;
         }
-
     }
+    invalidate_layout(state);
 
     return 0;
 }
 
 void free_harnesses(program_state_t *state)
 {
+    finish_prefetch_job(state);
     harness_t *h = NULL;
     for (int i = 0; i < state->n_harnesses; ++i) {
         h = &state->harnesses[i];
         free(h->connectors);
+        free(h->splices);
+        free(h->pin_widths);
+        free(h->order);
+        free(h->row_pins);
+        free(h->pin_rows);
+        free(h->pin_wired);
+        free(h->curves);
+        free(h->connector_wire_offsets);
+        free(h->connector_wires);
+        free(h->lit.pins);
+        free(h->lit.wires);
+        free_grid(&h->grid);
+        free(h->visible);
     }
     free(state->harnesses);
+    state->harnesses = NULL;
 
 }
 
@@ -1055,45 +2106,34 @@ Color get_color_from_string(const char *str)
 
 int load_fonts(program_state_t *state)
 {
-    int font_size = FONT_SIZE * state->zoom_level;
-    if (font_size < 1) {
-        font_size = 1;
-    }
-    if (font_size > 50) {
-        font_size = 50;
-    }
-    if (IsFontValid(state->connector_font)) {
-        UnloadFont(state->connector_font);
-    }
-    
-    state->connector_font = LoadFontFromMemory(
-        ".ttf",
-        assets_fonts_FiraCode_Bold_ttf,
-        assets_fonts_FiraCode_Bold_ttf_len,
-        font_size, NULL, 0
-    );
-    if (!IsFontValid(state->connector_font)) {
-        return 1;
-    }
-    if (IsFontValid(state->title_font)) {
-        UnloadFont(state->title_font);
-    }
-    state->title_font = LoadFontFromMemory(
-        ".ttf",
-        assets_fonts_FiraCode_Bold_ttf,
-        assets_fonts_FiraCode_Bold_ttf_len,
-        (int)(TITLE_FONT_SCALE * font_size), NULL, 0
-    );
-    if (!IsFontValid(state->title_font)) {
-        return 1;
+    state->font_sizes[CONNECTOR_FONT] = FONT_SIZE;
+    state->font_sizes[TITLE_FONT] = (int)(TITLE_FONT_SCALE * FONT_SIZE);
+    for (int i = 0; i < N_FONTS; ++i) {
+        if (IsFontValid(state->fonts[i])) {
+            UnloadFont(state->fonts[i]);
+        }
+        state->fonts[i] = LoadFontFromMemory(
+            ".ttf",
+            assets_fonts_FiraCode_Bold_ttf,
+            assets_fonts_FiraCode_Bold_ttf_len,
+            (int)(state->font_sizes[i] * FONT_RASTER_SCALE), NULL, 0
+        );
+        if (!IsFontValid(state->fonts[i])) {
+            return 1;
+        }
+        // Smooth when the camera scales text down
+        GenTextureMipmaps(&state->fonts[i].texture);
+        SetTextureFilter(state->fonts[i].texture, TEXTURE_FILTER_TRILINEAR);
     }
+    // Everything measured with the old fonts
+    invalidate_layout(state);
 
     return 0;
 }
 
-int draw_text(program_state_t *state, Font font, char *text, Vector2 position, int font_spacing, Color default_color, Color highlighed_color, int force_highlight, int hidden, int *is_under_pointer)
+// text_size is the measured size of text, from the layout
+int draw_text(program_state_t *state, Font font, const char *text, Vector2 position, Vector2 text_size, int font_spacing, Color default_color, Color highlighed_color, int force_highlight, int hidden, int *is_under_pointer)
 {
-    Vector2 text_size = MeasureTextEx(font, text, font.baseSize, font_spacing);
     Rectangle text_box = (Rectangle){position.x, position.y, text_size.x, text_size.y};
     Color color = default_color;
     int highlighted = CheckCollisionPointRec(state->mouse_position, text_box);
@@ -1107,7 +2147,7 @@ int draw_text(program_state_t *state, Font font, char *text, Vector2 position, i
         color = highlighed_color;
     }
     if (!hidden) {
-        DrawTextEx(font, text, position, font.baseSize, font_spacing, color);
+        DrawTextEx(font, text, position, text_size.y, font_spacing, color);
     }
 
     return highlighted;
@@ -1144,19 +2184,45 @@ void adjust_zoom(program_state_t *state, float amount)
 
 }
 
+// Saves the model on a worker thread; errors are reported when it finishes
 int export_harness_description(program_state_t *state)
 {
-    FILE *fp = fopen(state->harness_filename, "w");
-    if (fp == NULL) {
-        fprintf(stderr, "Error opening %s for writing\n", state->harness_filename);
+    for (int i = 0; i < state->n_harnesses; ++i) {
+        compact_harness_wires(state, &state->harness_descriptions[i]);
+    }
+
+    return start_save_job(state, state->harness_filename, -1, -1);
+}
+
+// Writes the selected variant of the current harness to
+// <harness file>-<variant name>.<extension>, without variant tags
+int export_variant(program_state_t *state)
+{
+    if (state->harness_index < 0 || state->harness_index >= state->n_harnesses) {
+        return 1;
+    }
+    harness_description_t *hd = &state->harness_descriptions[state->harness_index];
+    if (state->variant_index < 0 || state->variant_index >= hd->n_variants) {
+        fprintf(stderr, "No variant selected; press 'v' to choose one\n");
         return 1;
     }
 
-    harness_description_t *h = NULL;
-    connector_description_t *c = NULL;
-    pin_t *p = NULL;
-    wire_description_t *w = NULL;
-    fprintf(fp, "%sdark_background\n", state->dark_background ? "" : "#");
+    const char *variant = string_from_id(&state->strings, hd->variant_names[state->variant_index]);
+    const char *extension = strrchr(state->harness_filename, '.');
+    const char *directory_end = strrchr(state->harness_filename, '/');
+    if (extension != NULL && directory_end != NULL && extension < directory_end) {
+        extension = NULL;
+    }
+    int base_len = extension != NULL ? (int)(extension - state->harness_filename) : (int)strlen(state->harness_filename);
+    char filename[FILE_LINE_MAX_LEN] = {0};
+    snprintf(filename, FILE_LINE_MAX_LEN, "%.*s-%s%s", base_len, state->harness_filename, variant, extension != NULL ? extension : "");
+
+    return start_save_job(state, filename, state->harness_index, state->variant_index);
+}
+
+void write_file_header(FILE *fp, int dark_background)
+{
+    fprintf(fp, "%sdark_background\n", dark_background ? "" : "#");
     fprintf(fp, "# comments like this and empty lines are ignored\n");
     fprintf(fp, "# Format: consists of a 3-line 'harness' header\n");
     fprintf(fp, "# followed by one or more 'connector' descriptions\n");
@@ -1165,52 +2231,165 @@ int export_harness_description(program_state_t *state)
     fprintf(fp, "# The end of an enumerated list, such as a pin list, is denoted by '.' on a\n");
     fprintf(fp, "# line by itself.\n");
     fprintf(fp, "# Pins must appear in increasing order.\n");
-    for (int i = 0; i < state->n_harnesses; ++i) {
-        h = &state->harness_descriptions[0];
+    fprintf(fp, "\n");
+    fprintf(fp, "# A 'variants <name>,<name>...' line after the harness header declares\n");
+    fprintf(fp, "# variants. Connectors and wires tagged with a final ',@<name>|<name>...'\n");
+    fprintf(fp, "# field belong only to those variants; untagged ones belong to all.\n");
+    fprintf(fp, "\n");
+    fprintf(fp, "# A connector with an 'at=<x>:<y>' field is drawn at that position instead\n");
+    fprintf(fp, "# of in a column. The field is written when a connector is dragged.\n");
+    fprintf(fp, "\n");
+    fprintf(fp, "# Splices are declared in the wiring section as 'splice S<n>[,<name>]'\n");
+    fprintf(fp, "# and used as S<n> in place of a <conn_#>,<pin_#> pair.\n");
+}
+
+// Writes one harness. With variant < 0 the whole harness is written with its
+// variant tags; otherwise only that variant is written, untagged, and its
+// connectors are renumbered.
+int write_harness_description(FILE *fp, const string_table_t *strings, const harness_snapshot_t *hs, int harness_number, int variant)
+{
+    const harness_description_t *h = &hs->description;
+    const connector_description_t *c = NULL;
+    const pin_t *p = NULL;
+    wire_description_t wd = {0};
+    wire_description_t *w = &wd;
+    variant_mask_t selected = variant < 0 ? ALL_VARIANTS : VARIANT_BIT(variant);
+
+    // numbers[old connector number] is the connector's number in the output,
+    // or 0 if it is left out
+    int *numbers = malloc(sizeof *numbers * (h->n_connector_descriptions + 1));
+    if (numbers == NULL) {
+        fprintf(stderr, "Error allocating memory\n");
+        return 1;
+    }
+    int n_connectors = 0;
+    numbers[0] = 0;
+    for (int j = 0; j < h->n_connector_descriptions; ++j) {
+        numbers[j + 1] = 0;
+        if (variant < 0 || (SNAPSHOT_CONNECTOR(hs, j)->variants & selected)) {
+            numbers[j + 1] = ++n_connectors;
+        }
+    }
+
+    fprintf(fp, "\n");
+    fprintf(fp, "harness %d\n", harness_number);
+    fprintf(fp, "%s\n", string_from_id(strings, h->name));
+    fprintf(fp, "%s,%s,%s\n", string_from_id(strings, h->default_wire_length), string_from_id(strings, h->default_wire_gauge), string_from_id(strings, h->default_wire_colour));
+    if (variant < 0 && h->n_variants > 0) {
+        fprintf(fp, "variants ");
+        for (int k = 0; k < h->n_variants; ++k) {
+            fprintf(fp, "%s%s", k > 0 ? "," : "", string_from_id(strings, h->variant_names[k]));
+        }
         fprintf(fp, "\n");
-        fprintf(fp, "harness %d\n", i + 1);
-        fprintf(fp, "%s\n", h->name);
-        fprintf(fp, "%s,%s,%s\n", h->default_wire_length, h->default_wire_gauge, h->default_wire_colour);
+    }
+    fprintf(fp, "\n");
+    for (int j = 0; j < h->n_connector_descriptions; ++j) {
+        if (numbers[j + 1] == 0) {
+            continue;
+        }
+        c = SNAPSHOT_CONNECTOR(hs, j);
+        fprintf(fp, "connector %d\n", numbers[j + 1]);
+        fprintf(fp, "# <name>,<type>,<mate>[,reversed][,at=<x>:<y>][,@<variant>|<variant>...]\n");
+        fprintf(fp, "%s,%s,%s%s", string_from_id(strings, c->name), string_from_id(strings, c->type), string_from_id(strings, c->mate), c->mirror_lr ? ",reversed" : "");
+        if (c->placed) {
+            fprintf(fp, ",at=%g:%g", c->x, c->y);
+        }
+        if (variant < 0) {
+            write_variant_tags(fp, strings, h, c->variants);
+        }
         fprintf(fp, "\n");
-        for (int j = 0; j < h->n_connector_descriptions; ++j) {
-            c = &h->connector_descriptions[j];
-            fprintf(fp, "connector %d\n", j + 1);
-            fprintf(fp, "# <name>,<type>,<mate>[,reversed]\n");
-            fprintf(fp, "%s,%s,%s%s\n", c->name, c->type, c->mate, c->mirror_lr ? ",reversed" : "");
-            for (int k = 0; k < c->n_pins; ++k) {
-                p = &c->pins[k];
-                fprintf(fp, "%d %s\n", p->number, p->name);
-            }
-            fprintf(fp, ".\n");
-            fprintf(fp, "\n");
-        }
-
-        fprintf(fp, "wiring\n");
-        fprintf(fp, "# <src_conn_#>,<src_pin_#>,<dst_conn_#>,<dst_pin_#>[,<wire_colour>][,<wire_thickness][,<wire_gauge>]\n");
-        for (int j = 0; j < h->n_wire_descriptions; ++j) {
-            w = &h->wire_descriptions[j];
-            fprintf(fp, "%d,%d,%d,%d", w->c1, w->c1_pin, w->c2, w->c2_pin);
-            if (strcmp(w->colour, h->default_wire_colour) != 0) {
-                fprintf(fp, ",%s", w->colour);
-                if (w->thickness != DEFAULT_WIRE_THICKNESS) {
-                    fprintf(fp, ",%g", w->thickness);
-                    if (strcmp(w->gauge, h->default_wire_gauge) != 0) {
-                        fprintf(fp, ",%s", w->gauge);
-                    }
-                }
-            }
-            fprintf(fp, "\n");
+        for (int k = 0; k < c->n_pins; ++k) {
+            p = &c->pins[k];
+            fprintf(fp, "%d %s\n", p->number, string_from_id(strings, p->name));
         }
         fprintf(fp, ".\n");
+        fprintf(fp, "\n");
     }
 
-    fclose(fp);
-    fflush(fp);
+    fprintf(fp, "wiring\n");
+    fprintf(fp, "# <src_conn_#>,<src_pin_#>,<dst_conn_#>,<dst_pin_#>[,<wire_colour>][,<wire_thickness>][,<wire_gauge>][,<wire_length>][,@<variant>|<variant>...]\n");
+    fprintf(fp, "# Leave an optional field empty to use the default, e.g. 1,2,3,4,,,22awg\n");
+    for (int j = 0; j < h->n_splices; ++j) {
+        fprintf(fp, "splice S%d", j + 1);
+        if (h->splices[j].name != 0) {
+            fprintf(fp, ",%s", string_from_id(strings, h->splices[j].name));
+        }
+        fprintf(fp, "\n");
+    }
+    int c1 = 0;
+    int c2 = 0;
+    for (int j = 0; j < h->wires.n_wires; ++j) {
+        if (SNAPSHOT_WIRE_IS_DEAD(hs, j)) {
+            continue;
+        }
+        wd = get_snapshot_wire(hs, j);
+        c1 = w->c1;
+        c2 = w->c2;
+        if (variant >= 0) {
+            if (c1 < 0 || c1 > h->n_connector_descriptions || c2 < 0 || c2 > h->n_connector_descriptions || !snapshot_wire_in_variants(hs, j, selected)) {
+                continue;
+            }
+            c1 = numbers[c1];
+            c2 = numbers[c2];
+        }
+        write_endpoint(fp, c1, w->c1_pin);
+        fprintf(fp, ",");
+        write_endpoint(fp, c2, w->c2_pin);
+        // Write fields up to the last one that differs from its default
+        int n_fields = 0;
+        if (w->length != 0) {
+            n_fields = 4;
+        } else if (w->gauge != 0) {
+            n_fields = 3;
+        } else if (w->thickness != DEFAULT_WIRE_THICKNESS) {
+            n_fields = 2;
+        } else if (w->colour != h->default_wire_colour) {
+            n_fields = 1;
+        }
+        if (n_fields >= 1) {
+            fprintf(fp, ",%s", w->colour != h->default_wire_colour ? string_from_id(strings, w->colour) : "");
+        }
+        if (n_fields >= 2) {
+            if (w->thickness != DEFAULT_WIRE_THICKNESS) {
+                fprintf(fp, ",%g", w->thickness);
+            } else {
+                fprintf(fp, ",");
+            }
+        }
+        if (n_fields >= 3) {
+            fprintf(fp, ",%s", string_from_id(strings, w->gauge));
+        }
+        if (n_fields >= 4) {
+            fprintf(fp, ",%s", string_from_id(strings, w->length));
+        }
+        if (variant < 0) {
+            write_variant_tags(fp, strings, h, w->variants);
+        }
+        fprintf(fp, "\n");
+    }
+    fprintf(fp, ".\n");
+
+    free(numbers);
 
     return 0;
 }
 
-harness_description_t *make_harness_description_template(void)
+void write_variant_tags(FILE *fp, const string_table_t *strings, const harness_description_t *h, variant_mask_t variants)
+{
+    variant_mask_t declared = declared_variants(h);
+    if ((variants & declared) == declared) {
+        return;
+    }
+    fprintf(fp, ",@");
+    int n = 0;
+    for (int k = 0; k < h->n_variants; ++k) {
+        if (variants & VARIANT_BIT(k)) {
+            fprintf(fp, "%s%s", n++ > 0 ? "|" : "", string_from_id(strings, h->variant_names[k]));
+        }
+    }
+}
+
+harness_description_t *make_harness_description_template(program_state_t *state)
 {
     harness_description_t *h = malloc(sizeof *h);
     if (h == NULL) {
@@ -1219,41 +2398,42 @@ harness_description_t *make_harness_description_template(void)
     }
     memset(h, 0, sizeof *h);
 
-    h->name = strdup("<name>");
-    h->default_wire_length = strdup("30cm");
-    h->default_wire_gauge = strdup("26awg");
-    h->default_wire_colour = strdup("GRAY");
+    string_table_t *strings = &state->strings;
+    h->name = intern_string(strings, "<name>");
+    h->default_wire_length = intern_string(strings, "30cm");
+    h->default_wire_gauge = intern_string(strings, "26awg");
+    h->default_wire_colour = intern_string(strings, "GRAY");
 
-    connector_description_t *c = add_connector_description(h, "J1", "header", "plug", 5);
+    connector_description_t *c = add_connector_description(state, h, "J1", "header", "plug", 5);
     if (c == NULL) {
         return NULL;
     }
-    c->pins[0].name = strdup("+5V");
-    c->pins[1].name = strdup("AGND");
+    c->pins[0].name = intern_string(strings, "+5V");
+    c->pins[1].name = intern_string(strings, "AGND");
 
-    c = add_connector_description(h, "J2", "header", "plug", 2);
+    c = add_connector_description(state, h, "J2", "header", "plug", 2);
     if (c == NULL) {
         return NULL;
     }
-    c->pins[0].name = strdup("3V3");
-    c->pins[1].name = strdup("DGND");
+    c->pins[0].name = intern_string(strings, "3V3");
+    c->pins[1].name = intern_string(strings, "DGND");
 
-    c = add_connector_description(h, "J3", "DB9", "socket", 5);
+    c = add_connector_description(state, h, "J3", "DB9", "socket", 5);
     if (c == NULL) {
         return NULL;
     }
     c->mirror_lr = 1;
-    c->pins[0].name = strdup("+5V");
-    c->pins[1].name = strdup("+5V_RTN");
-    c->pins[2].name = strdup("NC");
-    c->pins[3].name = strdup("3V3");
-    c->pins[4].name = strdup("3V3_RTN");
+    c->pins[0].name = intern_string(strings, "+5V");
+    c->pins[1].name = intern_string(strings, "+5V_RTN");
+    c->pins[2].name = intern_string(strings, "NC");
+    c->pins[3].name = intern_string(strings, "3V3");
+    c->pins[4].name = intern_string(strings, "3V3_RTN");
 
     return h;
 
 }
 
-connector_description_t *add_connector_description(harness_description_t *h, const char *name, const char *type, const char *mate, int n_pins)
+connector_description_t *add_connector_description(program_state_t *state, harness_description_t *h, const char *name, const char *type, const char *mate, int n_pins)
 {
     void *mem = realloc(h->connector_descriptions, sizeof *h->connector_descriptions * (h->n_connector_descriptions + 1));
     if (mem == NULL) {
@@ -1265,26 +2445,34 @@ connector_description_t *add_connector_description(harness_description_t *h, con
 
     connector_description_t *c = &h->connector_descriptions[h->n_connector_descriptions - 1];
     memset(c, 0, sizeof *c);
-    c->name = strdup(name);
+    c->name = intern_string(&state->strings, name);
     c->number = h->n_connector_descriptions;
-    c->type = strdup(type);
-    c->mate = strdup(mate);
+    c->generation = next_generation(state);
+    c->variants = ALL_VARIANTS;
+    c->type = intern_string(&state->strings, type);
+    c->mate = intern_string(&state->strings, mate);
     c->n_pins = n_pins;
     c->pins = malloc(sizeof *c->pins * n_pins);
     if (c->pins == NULL) {
         return NULL;
     }
+    string_id_t no_connection = intern_string(&state->strings, "NC");
     for (int i = 0; i < n_pins; ++i) {
-        c->pins[i].name = strdup("NC");
+        c->pins[i].name = no_connection;
         c->pins[i].number = i + 1;
-        c->pins[i].is_highlighted = 0;
     }
+    index_harness_pins(h);
 
     return c;
 }
 
 void free_harness_descriptions(program_state_t *state)
 {
+    // Snapshots borrow pins and splices from the model
+    (void)finish_save_job(state);
+    finish_order_job(state);
+    release_snapshot(atomic_exchange(&state->snapshot, NULL));
+
     harness_description_t *hd = NULL;
     for (int i = 0; i < state->n_harnesses; ++i) {
         hd = &state->harness_descriptions[i];
@@ -1292,11 +2480,21 @@ void free_harness_descriptions(program_state_t *state)
             free_connector_description(&hd->connector_descriptions[j]);
         }
         free(hd->connector_descriptions);
-        free(hd->wire_descriptions);
+        free(hd->changed_connector_blocks);
+        free(hd->splices);
+        free_splice_graph(&hd->splice_graph);
+        free_vertex_wires(&hd->vertex_wires);
+        free_net_table(&hd->nets);
+        free_wire_table(&hd->wires);
     }
     free(state->harness_descriptions);
     state->harness_descriptions = NULL;
     state->n_harnesses = 0;
+    free_string_table(&state->strings);
+    free_view_state(&state->view);
+    free_selection(state);
+    free_pin_name_index(&state->pin_names);
+    free_edit_history(&state->history);
 }
 
 int export_template(int dark_background) 
@@ -1305,9 +2503,16 @@ int export_template(int dark_background)
     template_state.dark_background = dark_background;
 
     template_state.harness_filename = "template_harness.txt";
-    template_state.harness_descriptions = make_harness_description_template();
+    template_state.harness_descriptions = make_harness_description_template(&template_state);
+    if (template_state.harness_descriptions == NULL) {
+        free_string_table(&template_state.strings);
+        return 1;
+    }
     template_state.n_harnesses = 1;
     int export_status = export_harness_description(&template_state);
+    if (export_status == 0) {
+        export_status = finish_save_job(&template_state);
+    }
     free_harness_descriptions(&template_state);
 
     return export_status;
@@ -1317,51 +2522,69 @@ void try_to_delete_wire(program_state_t *state)
 {
     // Is a pin under the mouse pointer?
 
-    connector_t *c = NULL;
     connector_description_t *cd = NULL;
-    wire_description_t *wd = NULL;
     pin_t *p = NULL;
-    int yoff = 0;
-    int xoff = 0;
+    endpoint_t e = 0;
 
-    harness_t *h = &state->harnesses[state->harness_index];
     harness_description_t *hd = &state->harness_descriptions[state->harness_index];
-    int n_wires = hd->n_wire_descriptions;
-    for (int j = 0; j < hd->n_connector_descriptions; ++j) {
+    wire_table_t *wires = &hd->wires;
+    variant_mask_t variants = selected_variants(state, hd);
+    int update_nets_locally = nets_current(hd, variants);
+    int n_removed = 0;
+    if (!has_wire_to_edit(state, hd, variants)) {
+        return;
+    }
+    begin_edit_step(state);
+    // The selection goes in one step. Its nets are rebuilt when next needed.
+    int n_selected = 0;
+    for (int l = next_selected_wire(state, 0); l >= 0; l = next_selected_wire(state, l + 1)) {
+        remove_wire(state, hd, l, variants);
+        n_selected++;
+    }
+    if (n_selected > 0) {
+        update_nets_locally = 0;
+    }
+    int wire = n_selected > 0 ? -1 : picked_wire(state);
+    if (wire >= 0) {
+        int v = endpoint_vertex(hd, wires->end1[wire]);
+        if (v < 0) {
+            v = endpoint_vertex(hd, wires->end2[wire]);
+        }
+        remove_wire(state, hd, wire, variants);
+        if (update_nets_locally) {
+            split_net(hd, v);
+        }
+    }
+    // Otherwise the pins under the pointer lose all their wires
+    for (int j = 0; n_selected == 0 && wire < 0 && j < hd->n_connector_descriptions; ++j) {
         cd = &hd->connector_descriptions[j];
         for (int k = 0; k < cd->n_pins; ++k) {
             p = &cd->pins[k];
-            if (p->is_under_pointer) {
-                // Delete all wires connected to this pin
-                for (int l = n_wires - 1; l >= 0; --l) {
-                    wd = &hd->wire_descriptions[l];
-                    if (pin_matches(wd, cd, p)) {
-                        hd->changed = 1;
-                        if (l < n_wires - 1) {
-                            memmove(wd, &hd->wire_descriptions[l + 1], sizeof *wd * (n_wires - 1 - l));
-                            memset(&hd->wire_descriptions[n_wires - 1], 0, sizeof *wd);
-                        }
-                        --n_wires;
+            if (BITSET_TEST(state->view.pin_under_pointer, cd->first_pin + k)) {
+                n_removed = 0;
+                e = ENDPOINT(cd->number, p->number);
+                for (int l = find_wire_with_endpoint(wires, e, 0); l >= 0; l = find_wire_with_endpoint(wires, e, l + 1)) {
+                    if (!wire_in_variants(hd, l, variants)) {
+                        continue;
                     }
+                    n_removed++;
+                    remove_wire(state, hd, l, variants);
                 }
-                if (n_wires < hd->n_wire_descriptions) {
-                    hd->n_wire_descriptions = n_wires;
-                    if (n_wires > 0) {
-                        void *mem = realloc(hd->wire_descriptions, sizeof *hd->wire_descriptions * hd->n_wire_descriptions);
-                        if (mem == NULL) {
-                            fprintf(stderr, "Error reallocating memory\n");
-                        }
-                        hd->wire_descriptions = mem;
-                    } else {
-                        free(hd->wire_descriptions);
-                        hd->wire_descriptions = NULL;
-                    }
+                // The pin's net may have fallen apart
+                if (update_nets_locally && n_removed > 0) {
+                    split_net(hd, cd->first_pin + k);
                 }
                 // Handled this pin
-                p->is_under_pointer = 0;
+                BITSET_CLEAR(state->view.pin_under_pointer, cd->first_pin + k);
             }
         }
     }
+    if (update_nets_locally) {
+        hd->nets.version = wires->version;
+    }
+    if (wires->n_dead >= WIRE_COMPACTION_MIN_DEAD && wires->n_dead > WIRE_COMPACTION_THRESHOLD * wires->n_wires) {
+        compact_harness_wires(state, hd);
+    }
 
     return;
 }
@@ -1369,40 +2592,62 @@ void try_to_delete_wire(program_state_t *state)
 void try_to_add_wire(program_state_t *state)
 {
     harness_description_t *hd = &state->harness_descriptions[state->harness_index];
-    wire_description_t *wd = NULL;
-    if (state->p1_under_pointer == NULL || state->p2_under_pointer == NULL) {
+    wire_table_t *wires = &hd->wires;
+    connector_description_t *c1 = NULL;
+    connector_description_t *c2 = NULL;
+    pin_t *p1 = resolve_pin(hd, state->p1_under_pointer, &c1);
+    pin_t *p2 = resolve_pin(hd, state->p2_under_pointer, &c2);
+    if (p1 == NULL || p2 == NULL) {
+        // Pins went away (or the harness changed) while dragging
+        reset_pin_under_pointer_states(state);
         return;
     }
-    int c1 = state->c1_under_pointer->number;
-    int p1 = state->p1_under_pointer->number;
-    int c2 = state->c2_under_pointer->number;
-    int p2 = state->p2_under_pointer->number;
+    endpoint_t e1 = ENDPOINT(c1->number, p1->number);
+    endpoint_t e2 = ENDPOINT(c2->number, p2->number);
+    variant_mask_t variants = selected_variants(state, hd);
+    int update_nets_locally = nets_current(hd, variants);
     int wire_exists = 0;
-    for (int i = 0; i < hd->n_wire_descriptions; ++i) {
-        wd = &hd->wire_descriptions[i];
-        if ((((wd->c1 == c1 && wd->c1_pin == p1) && (wd->c2 == c2 && wd->c2_pin == p2)) || ((wd->c1 == c2 && wd->c1_pin == p2) && (wd->c2 == c1 && wd->c2_pin == p1)))) {
+    begin_edit_step(state);
+    for (int i = find_wire_with_endpoint(wires, e1, 0); i >= 0; i = find_wire_with_endpoint(wires, e1, i + 1)) {
+        if ((wires->end1[i] == e1 && wires->end2[i] == e2) || (wires->end1[i] == e2 && wires->end2[i] == e1)) {
             wire_exists = 1;
+            // Adding an existing wire while a variant is selected adds it
+            // to that variant
+            if (!wire_in_variants(hd, i, variants)) {
+                edit_value_t before = {.variants = wires->variants[i]};
+                wires->variants[i] |= variants;
+                MARK_WIRE_CHANGED(wires, i);
+                // Variant membership changes the nets
+                wires->version++;
+                record_wire_change(state, hd, EDIT_WIRE_VARIANTS, i, before, (edit_value_t){.variants = wires->variants[i]});
+                mark_harness_edited(state, hd);
+                if (update_nets_locally) {
+                    add_wire_to_nets(hd, i);
+                    hd->nets.version = wires->version;
+                }
+            }
+            break;
         }
     }
     if (!wire_exists) {
-        void *mem = realloc(hd->wire_descriptions, sizeof *hd->wire_descriptions * (hd->n_wire_descriptions + 1));
-        if (mem == NULL) {
-            fprintf(stderr, "Error allocating memory\n");
-            return;
+        wire_description_t wd = {0};
+        wd.c1 = ENDPOINT_CONNECTOR(e1);
+        wd.c1_pin = ENDPOINT_PIN(e1);
+        wd.c2 = ENDPOINT_CONNECTOR(e2);
+        wd.c2_pin = ENDPOINT_PIN(e2);
+        wd.colour = hd->default_wire_colour;
+        wd.thickness = DEFAULT_WIRE_THICKNESS;
+        wd.straight_fraction = DEFAULT_WIRE_STRAIGHT_FRACTION;
+        wd.variants = variants;
+        int index = append_wire(wires, &wd, next_generation(state));
+        if (index >= 0) {
+            record_wire_presence(state, hd, EDIT_ADD_WIRE, index);
+            mark_harness_edited(state, hd);
+            if (update_nets_locally) {
+                add_wire_to_nets(hd, index);
+                hd->nets.version = wires->version;
+            }
         }
-        hd->wire_descriptions = mem;
-        hd->n_wire_descriptions++;
-        wd = &hd->wire_descriptions[hd->n_wire_descriptions - 1];
-        wd->c1 = c1;
-        wd->c1_pin = p1;
-        wd->c2 = c2;
-        wd->c2_pin = p2;
-        wd->colour = hd->default_wire_colour;
-        wd->length = hd->default_wire_length;
-        wd->gauge = hd->default_wire_gauge;
-        wd->thickness = DEFAULT_WIRE_THICKNESS;
-        wd->straight_fraction = DEFAULT_WIRE_STRAIGHT_FRACTION;
-        wd->is_highlighted = 0;
     }
     reset_pin_under_pointer_states(state);
 }
@@ -1414,8 +2659,8 @@ void draw_pin_to_pointer(program_state_t *state)
     Vector2 offset1 = {state->wire_drawing_first_end.x + dx, state->wire_drawing_first_end.y};
     Vector2 offset2 = {state->mouse_position.x - dx, state->mouse_position.y};
     Vector2 points[] = {state->wire_drawing_first_end, offset1, offset2, state->mouse_position};
-    DrawSplineBezierCubic(points, 4, (DEFAULT_WIRE_THICKNESS + 4.5) * state->zoom_level, get_color_from_string(DEFAULT_HIGHLIGHT_COLOR));
-    DrawSplineBezierCubic(points, 4, (DEFAULT_WIRE_THICKNESS) * state->zoom_level, state->foreground_color);
+    DrawSplineBezierCubic(points, 4, DEFAULT_WIRE_THICKNESS + 4.5, get_color_from_string(DEFAULT_HIGHLIGHT_COLOR));
+    DrawSplineBezierCubic(points, 4, DEFAULT_WIRE_THICKNESS, state->foreground_color);
 
     return;
 }
@@ -1424,61 +2669,51 @@ void reset_pin_under_pointer_states(program_state_t *state)
 {
     // Is a pin under the mouse pointer?
 
-    connector_t *c = NULL;
-    connector_description_t *cd = NULL;
-    wire_description_t *wd = NULL;
-    pin_t *p = NULL;
-    int yoff = 0;
-    int xoff = 0;
-
-    harness_t *h = &state->harnesses[state->harness_index];
     harness_description_t *hd = &state->harness_descriptions[state->harness_index];
-    int n_wires = hd->n_wire_descriptions;
-    for (int j = 0; j < hd->n_connector_descriptions; ++j) {
-        cd = &hd->connector_descriptions[j];
-        for (int k = 0; k < cd->n_pins; ++k) {
-            cd->pins[k].is_under_pointer = 0;
-        }
+    if (state->view.pin_under_pointer != NULL) {
+        memset(state->view.pin_under_pointer, 0, sizeof *state->view.pin_under_pointer * BITSET_WORDS(hd->n_pins));
     }
     state->n_pins_under_pointer = 0;
-    state->c1_under_pointer = NULL;
-    state->p1_under_pointer = NULL;
-    state->c2_under_pointer = NULL;
-    state->p2_under_pointer = NULL;
+    state->p1_under_pointer = NULL_HANDLE;
+    state->p2_under_pointer = NULL_HANDLE;
 
     return;
 }
 
 void change_wire_colour(program_state_t *state, int direction)
 {
-    connector_t *c = NULL;
     connector_description_t *cd = NULL;
-    wire_description_t *wd = NULL;
     pin_t *p = NULL;
-    int yoff = 0;
-    int xoff = 0;
 
-    harness_t *h = &state->harnesses[state->harness_index];
     harness_description_t *hd = &state->harness_descriptions[state->harness_index];
-    int n_wires = hd->n_wire_descriptions;
+    if (!has_wire_to_edit(state, hd, selected_variants(state, hd))) {
+        return;
+    }
+    begin_edit_step(state);
+    int n_selected = 0;
+    for (int l = next_selected_wire(state, 0); l >= 0; l = next_selected_wire(state, l + 1)) {
+        recolour_wire(state, hd, l, direction);
+        n_selected++;
+    }
+    if (n_selected > 0) {
+        return;
+    }
+    int l = picked_wire(state);
+    if (l >= 0) {
+        recolour_wire(state, hd, l, direction);
+        return;
+    }
     for (int j = 0; j < hd->n_connector_descriptions; ++j) {
         cd = &hd->connector_descriptions[j];
         for (int k = 0; k < cd->n_pins; ++k) {
             p = &cd->pins[k];
-            if (p->is_under_pointer) {
-                for (int l = n_wires - 1; l >= 0; --l) {
-                    wd = &hd->wire_descriptions[l];
-                    if (pin_matches(wd, cd, p)) {
-                        if (direction == 1) {
-                            wd->colour = next_colour(wd->colour);
-                        } else {
-                            wd->colour = previous_colour(wd->colour);
-                        }
-                        break;
-                    }
+            if (BITSET_TEST(state->view.pin_under_pointer, cd->first_pin + k)) {
+                l = find_last_wire_in_variants(hd, ENDPOINT(cd->number, p->number), selected_variants(state, hd));
+                if (l >= 0) {
+                    recolour_wire(state, hd, l, direction);
                 }
                 // Handled this pin
-                p->is_under_pointer = 0;
+                BITSET_CLEAR(state->view.pin_under_pointer, cd->first_pin + k);
             }
         }
     }
@@ -1486,9 +2721,9 @@ void change_wire_colour(program_state_t *state, int direction)
     return;
 }
 
-char *next_colour(const char *str)
+const char *next_colour(const char *str)
 {
-    char * c = "BLACK";
+    const char *c = "BLACK";
     if (strcmp("GRAY", str) == 0) {
         c = "RED";
     } else if (strcmp("RED", str) == 0) {
@@ -1547,12 +2782,12 @@ char *next_colour(const char *str)
         c = "GRAY";
     } 
 
-    return strdup(c);
+    return c;
 }
 
-char *previous_colour(const char *str)
+const char *previous_colour(const char *str)
 {
-    char * c = "BLACK";
+    const char *c = "BLACK";
     if (strcmp("GRAY", str) == 0) {
         c = "RAYWHITE";
     } else if (strcmp("RED", str) == 0) {
@@ -1611,38 +2846,43 @@ char *previous_colour(const char *str)
         c = "MAGENTA";
     } 
 
-    return strdup(c);
+    return c;
 }
 
 void change_wire_thickness(program_state_t *state, float delat_amount)
 {
-    connector_t *c = NULL;
     connector_description_t *cd = NULL;
-    wire_description_t *wd = NULL;
     pin_t *p = NULL;
-    int yoff = 0;
-    int xoff = 0;
 
-    harness_t *h = &state->harnesses[state->harness_index];
     harness_description_t *hd = &state->harness_descriptions[state->harness_index];
-    int n_wires = hd->n_wire_descriptions;
+    if (!has_wire_to_edit(state, hd, selected_variants(state, hd))) {
+        return;
+    }
+    begin_edit_step(state);
+    int n_selected = 0;
+    for (int l = next_selected_wire(state, 0); l >= 0; l = next_selected_wire(state, l + 1)) {
+        thicken_wire(state, hd, l, delat_amount);
+        n_selected++;
+    }
+    if (n_selected > 0) {
+        return;
+    }
+    int l = picked_wire(state);
+    if (l >= 0) {
+        thicken_wire(state, hd, l, delat_amount);
+        return;
+    }
     for (int j = 0; j < hd->n_connector_descriptions; ++j) {
         cd = &hd->connector_descriptions[j];
         for (int k = 0; k < cd->n_pins; ++k) {
             p = &cd->pins[k];
-            if (p->is_under_pointer) {
-                for (int l = n_wires - 1; l >= 0; --l) {
-                    wd = &hd->wire_descriptions[l];
-                    if (pin_matches(wd, cd, p)) {
-                        wd->thickness += delat_amount;
-                        if (wd->thickness < 0.5) {
-                            wd->thickness = 0.5;
-                        }
-                        break;
-                    }
+            if (BITSET_TEST(state->view.pin_under_pointer, cd->first_pin + k)) {
+                l = find_last_wire_in_variants(hd, ENDPOINT(cd->number, p->number), selected_variants(state, hd));
+                if (l >= 0) {
+                    thicken_wire(state, hd, l, delat_amount);
                 }
                 // Handled this pin
-                p->is_under_pointer = 0;
+                BITSET_CLEAR(state->view.pin_under_pointer, cd->first_pin + k);
             }
         }
     }
@@ -1652,15 +2892,4638 @@ void change_wire_thickness(program_state_t *state, float delat_amount)
 
 void mirror_connector_lr(program_state_t *state)
 {
-    connector_t *c = NULL;
     harness_t *h = &state->harnesses[state->harness_index];
-    for (int i = 0; i < h->n_connectors; ++i) {
-        c = &h->connectors[i];
-        if (CheckCollisionPointRec(state->mouse_position, c->outline)) {
-            h->description->connector_descriptions[i].mirror_lr = !h->description->connector_descriptions[i].mirror_lr;
-            break;
-        }
+    connector_description_t *cds = h->description->connector_descriptions;
+    int i = next_selected_connector(state, 0);
+    if (i < 0) {
+        i = find_connector_at(state, h, state->mouse_position);
+    }
+    if (i < 0) {
+        return;
     }
+    // Every selected connector flips in one step
+    begin_edit_step(state);
+    do {
+        cds[i].mirror_lr = !cds[i].mirror_lr;
+        mark_connector_changed(h->description, i);
+        record_edit(state, &(edit_t){.kind = EDIT_MIRROR_CONNECTOR, .harness = state->harness_index, .connector = i});
+        invalidate_connector_layout(state, state->harness_index, i);
+        i = next_selected_connector(state, i + 1);
+    } while (i >= 0);
+    mark_harness_edited(state, h->description);
 
     return;
 }
+
+uint32_t hash_string(const char *str)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *s = (const unsigned char *)str; *s != '\0'; ++s) {
+        hash ^= *s;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+char *string_arena_alloc(string_table_t *t, size_t len)
+{
+    string_arena_block_t *b = t->blocks;
+    if (b == NULL || b->size - b->used < len) {
+        size_t size = len > STRING_ARENA_BLOCK_SIZE ? len : STRING_ARENA_BLOCK_SIZE;
+        b = malloc(sizeof *b + size);
+        if (b == NULL) {
+            fprintf(stderr, "Error allocating memory\n");
+            return NULL;
+        }
+        b->size = size;
+        b->used = 0;
+        b->next = t->blocks;
+        t->blocks = b;
+    }
+    char *str = &b->data[b->used];
+    b->used += len;
+
+    return str;
+}
+
+int grow_string_slots(string_table_t *t)
+{
+    uint32_t n_slots = t->n_slots == 0 ? STRING_TABLE_INITIAL_SLOTS : t->n_slots * 2;
+    string_id_t *slots = calloc(n_slots, sizeof *slots);
+    if (slots == NULL) {
+        fprintf(stderr, "Error allocating memory\n");
+        return 1;
+    }
+    for (uint32_t id = 1; id < t->n_strings; ++id) {
+        uint32_t slot = t->hashes[id] & (n_slots - 1);
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & (n_slots - 1);
+        }
+        slots[slot] = id;
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->n_slots = n_slots;
+
+    return 0;
+}
+
+string_id_t intern_string(string_table_t *t, const char *str)
+{
+    if (str == NULL || str[0] == '\0') {
+        return 0;
+    }
+    if (t->n_strings == 0) {
+        // Reserve id 0 for the empty string
+        t->max_strings = STRING_TABLE_INITIAL_SLOTS / 2;
+        t->strings = alloc_string_index(t, t->max_strings);
+        t->hashes = malloc(sizeof *t->hashes * t->max_strings);
+        if (t->strings == NULL || t->hashes == NULL) {
+            fprintf(stderr, "Error allocating memory\n");
+            return 0;
+        }
+        t->strings[0] = "";
+        t->hashes[0] = 0;
+        t->n_strings = 1;
+    }
+
+    uint32_t hash = hash_string(str);
+    if (t->n_slots != 0) {
+        uint32_t slot = hash & (t->n_slots - 1);
+        string_id_t id = 0;
+        while ((id = t->slots[slot]) != 0) {
+            if (t->hashes[id] == hash && strcmp(t->strings[id], str) == 0) {
+                return id;
+            }
+            slot = (slot + 1) & (t->n_slots - 1);
+        }
+    }
+
+    // Keep the hash at most half full
+    if (2 * (t->n_strings + 1) > t->n_slots && grow_string_slots(t) != 0) {
+        return 0;
+    }
+    if (t->n_strings == t->max_strings) {
+        uint32_t max_strings = t->max_strings * 2;
+        const char **strings = alloc_string_index(t, max_strings);
+        if (strings == NULL) {
+            return 0;
+        }
+        memcpy(strings, t->strings, sizeof *strings * t->n_strings);
+        t->strings = strings;
+        void *mem = realloc(t->hashes, sizeof *t->hashes * max_strings);
+        if (mem == NULL) {
+            fprintf(stderr, "Error allocating memory\n");
+            return 0;
+        }
+        t->hashes = mem;
+        t->max_strings = max_strings;
+    }
+
+    size_t len = strlen(str) + 1;
+    char *copy = string_arena_alloc(t, len);
+    if (copy == NULL) {
+        return 0;
+    }
+    memcpy(copy, str, len);
+
+    string_id_t id = t->n_strings++;
+    t->strings[id] = copy;
+    t->hashes[id] = hash;
+    uint32_t slot = hash & (t->n_slots - 1);
+    while (t->slots[slot] != 0) {
+        slot = (slot + 1) & (t->n_slots - 1);
+    }
+    t->slots[slot] = id;
+
+    return id;
+}
+
+// Allocates a strings array in its own arena block, which stays allocated
+// until the table is freed
+const char **alloc_string_index(string_table_t *t, uint32_t max_strings)
+{
+    size_t size = sizeof(const char *) * max_strings;
+    string_arena_block_t *b = malloc(sizeof *b + size);
+    if (b == NULL) {
+        fprintf(stderr, "Error allocating memory\n");
+        return NULL;
+    }
+    b->size = size;
+    b->used = size;
+    // Link it behind the block strings are being allocated from
+    if (t->blocks != NULL) {
+        b->next = t->blocks->next;
+        t->blocks->next = b;
+    } else {
+        b->next = NULL;
+        t->blocks = b;
+    }
+
+    return (const char **)b->data;
+}
+
+const char *string_from_id(const string_table_t *t, string_id_t id)
+{
+    if (id >= t->n_strings) {
+        return "";
+    }
+    return t->strings[id];
+}
+
+void free_string_table(string_table_t *t)
+{
+    string_arena_block_t *b = t->blocks;
+    string_arena_block_t *next = NULL;
+    while (b != NULL) {
+        next = b->next;
+        free(b);
+        b = next;
+    }
+    free(t->hashes);
+    free(t->slots);
+    memset(t, 0, sizeof *t);
+}
+
+int reserve_wires(wire_table_t *t, int max_wires)
+{
+    if (max_wires <= t->max_wires) {
+        return 0;
+    }
+    void *mem = NULL;
+#define GROW_WIRE_COLUMN(column) \
+    mem = realloc(t->column, sizeof *t->column * max_wires); \
+    if (mem == NULL) { \
+        fprintf(stderr, "Error allocating memory\n"); \
+        return 1; \
+    } \
+    t->column = mem;
+    GROW_WIRE_COLUMN(end1);
+    GROW_WIRE_COLUMN(end2);
+    GROW_WIRE_COLUMN(colour);
+    GROW_WIRE_COLUMN(thickness);
+    GROW_WIRE_COLUMN(straight_fraction);
+    GROW_WIRE_COLUMN(variants);
+    GROW_WIRE_COLUMN(generation);
+#undef GROW_WIRE_COLUMN
+    int n_words = (max_wires + 63) / 64;
+    int old_n_words = (t->max_wires + 63) / 64;
+    mem = realloc(t->dead, sizeof *t->dead * n_words);
+    if (mem == NULL) {
+        fprintf(stderr, "Error allocating memory\n");
+        return 1;
+    }
+    t->dead = mem;
+    memset(&t->dead[old_n_words], 0, sizeof *t->dead * (n_words - old_n_words));
+    n_words = BITSET_WORDS(SNAPSHOT_WIRE_CHUNKS(max_wires));
+    old_n_words = BITSET_WORDS(SNAPSHOT_WIRE_CHUNKS(t->max_wires));
+    mem = realloc(t->changed_chunks, sizeof *t->changed_chunks * n_words);
+    if (mem == NULL) {
+        fprintf(stderr, "Error allocating memory\n");
+        return 1;
+    }
+    t->changed_chunks = mem;
+    memset(&t->changed_chunks[old_n_words], 0, sizeof *t->changed_chunks * (n_words - old_n_words));
+    t->max_wires = max_wires;
+
+    return 0;
+}
+
+// Returns the index of the new wire, or -1 on error
+int append_wire(wire_table_t *t, const wire_description_t *wd, uint32_t generation)
+{
+    if (t->n_wires == t->max_wires) {
+        int max_wires = t->max_wires == 0 ? WIRE_TABLE_INITIAL_SIZE : t->max_wires * 2;
+        if (reserve_wires(t, max_wires) != 0) {
+            return -1;
+        }
+    }
+    int index = t->n_wires++;
+    t->generation[index] = generation;
+    if (set_wire(t, index, wd) != 0) {
+        t->n_wires--;
+        return -1;
+    }
+
+    return index;
+}
+
+void delete_wire(wire_table_t *t, int index)
+{
+    if (index < 0 || index >= t->n_wires || WIRE_IS_DEAD(t, index)) {
+        return;
+    }
+    t->dead[index >> 6] |= (uint64_t)1 << (index & 63);
+    MARK_WIRE_CHANGED(t, index);
+    t->n_dead++;
+    t->version++;
+}
+
+// Drops deleted rows in one pass. If remap is not NULL it must hold n_wires
+// entries and receives each old row's new index, or -1 for deleted rows.
+// Returns the number of rows removed.
+int compact_wires(wire_table_t *t, int *remap)
+{
+    if (t->n_dead == 0) {
+        if (remap != NULL) {
+            for (int i = 0; i < t->n_wires; ++i) {
+                remap[i] = i;
+            }
+        }
+        return 0;
+    }
+    int n = 0;
+    // Overrides are sorted by row, so they are renumbered in the same pass
+    int k = 0;
+    int n_overrides = 0;
+    int first_dead = -1;
+    for (int i = 0; i < t->n_wires; ++i) {
+        for (; k < t->n_overrides && t->overrides[k].wire == i; ++k) {
+            if (!WIRE_IS_DEAD(t, i)) {
+                t->overrides[n_overrides] = t->overrides[k];
+                t->overrides[n_overrides].wire = n;
+                n_overrides++;
+            }
+        }
+        if (WIRE_IS_DEAD(t, i)) {
+            if (remap != NULL) {
+                remap[i] = -1;
+            }
+            if (first_dead < 0) {
+                first_dead = i;
+            }
+            continue;
+        }
+        if (remap != NULL) {
+            remap[i] = n;
+        }
+        if (n != i) {
+            t->end1[n] = t->end1[i];
+            t->end2[n] = t->end2[i];
+            t->colour[n] = t->colour[i];
+            t->thickness[n] = t->thickness[i];
+            t->straight_fraction[n] = t->straight_fraction[i];
+            t->variants[n] = t->variants[i];
+            t->generation[n] = t->generation[i];
+        }
+        ++n;
+    }
+    int n_removed = t->n_wires - n;
+    // Every row from the first deleted one on has moved
+    for (int c = first_dead / SNAPSHOT_WIRE_CHUNK_ROWS; c < SNAPSHOT_WIRE_CHUNKS(t->n_wires); ++c) {
+        BITSET_SET(t->changed_chunks, c);
+    }
+    t->overrides_changed = 1;
+    t->compactions++;
+    t->n_overrides = n_overrides;
+    memset(t->dead, 0, sizeof *t->dead * ((t->n_wires + 63) / 64));
+    t->n_wires = n;
+    t->n_dead = 0;
+    t->version++;
+
+    return n_removed;
+}
+
+// Compacts a harness's wire table. Anything holding wire indexes into this
+// harness must be remapped here.
+void compact_harness_wires(program_state_t *state, harness_description_t *hd)
+{
+    if (hd->wires.n_dead == 0) {
+        return;
+    }
+    // Saving compacts every harness, including any being prefetched
+    finish_prefetch_job(state);
+    // Compaction moves wires but does not change what they connect
+    int nets_were_current = hd->nets.parent != NULL && hd->nets.version == hd->wires.version;
+    // Recorded edits refer to wires by row, so they move with them
+    int *remap = NULL;
+    int harness = (int)(hd - state->harness_descriptions);
+    int selection = state->selection.harness == harness && state->selection.max_wire_words > 0;
+    int n_rows = hd->wires.n_wires;
+    if (state->history.undo.n_edits > 0 || state->history.redo.n_edits > 0 || selection) {
+        remap = malloc(sizeof *remap * hd->wires.n_wires);
+        if (remap == NULL) {
+            fprintf(stderr, "Error allocating memory\n");
+            return;
+        }
+    }
+    compact_wires(&hd->wires, remap);
+    if (remap != NULL) {
+        remap_edit_history(&state->history, harness, remap);
+        if (selection) {
+            remap_selection(&state->selection, remap, n_rows);
+        }
+        free(remap);
+    }
+    if (nets_were_current) {
+        hd->nets.version = hd->wires.version;
+    }
+}
+
+wire_description_t get_wire(const wire_table_t *t, int index)
+{
+    wire_description_t wd = {0};
+    wd.c1 = ENDPOINT_CONNECTOR(t->end1[index]);
+    wd.c1_pin = ENDPOINT_PIN(t->end1[index]);
+    wd.c2 = ENDPOINT_CONNECTOR(t->end2[index]);
+    wd.c2_pin = ENDPOINT_PIN(t->end2[index]);
+    wd.colour = t->colour[index];
+    wd.thickness = t->thickness[index];
+    wd.straight_fraction = t->straight_fraction[index];
+    wd.variants = t->variants[index];
+    int k = find_wire_override(t, index);
+    if (k >= 0) {
+        wd.gauge = t->overrides[k].gauge;
+        wd.length = t->overrides[k].length;
+    }
+
+    return wd;
+}
+
+int set_wire(wire_table_t *t, int index, const wire_description_t *wd)
+{
+    t->version++;
+    MARK_WIRE_CHANGED(t, index);
+    t->end1[index] = ENDPOINT(wd->c1, wd->c1_pin);
+    t->end2[index] = ENDPOINT(wd->c2, wd->c2_pin);
+    t->colour[index] = wd->colour;
+    t->thickness[index] = wd->thickness;
+    t->straight_fraction[index] = wd->straight_fraction;
+    t->variants[index] = wd->variants;
+
+    return set_wire_override(t, index, wd->gauge, wd->length);
+}
+
+// Bit k is set if wire index + k has an end at e. Requires index + 4 <= n_wires.
+int endpoint_match_mask(const wire_table_t *t, endpoint_t e, int index)
+{
+#if defined(__SSE2__)
+    __m128i key = _mm_set1_epi32((int)e);
+    __m128i a = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)&t->end1[index]), key);
+    __m128i b = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)&t->end2[index]), key);
+    return _mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(a, b)));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    uint32x4_t key = vdupq_n_u32(e);
+    uint32x4_t match = vorrq_u32(vceqq_u32(vld1q_u32(&t->end1[index]), key), vceqq_u32(vld1q_u32(&t->end2[index]), key));
+    static const uint32_t bits[4] = {1, 2, 4, 8};
+    return (int)vaddvq_u32(vandq_u32(match, vld1q_u32(bits)));
+#else
+    int mask = 0;
+    for (int k = 0; k < 4; ++k) {
+        if (t->end1[index + k] == e || t->end2[index + k] == e) {
+            mask |= 1 << k;
+        }
+    }
+    return mask;
+#endif
+}
+
+// First wire at or after start with an end at e, or -1
+int find_wire_with_endpoint(const wire_table_t *t, endpoint_t e, int start)
+{
+    int i = start < 0 ? 0 : start;
+    for (; i + 4 <= t->n_wires; i += 4) {
+        int mask = endpoint_match_mask(t, e, i);
+        if (mask != 0) {
+            for (int k = 0; k < 4; ++k) {
+                if ((mask & (1 << k)) && !WIRE_IS_DEAD(t, i + k)) {
+                    return i + k;
+                }
+            }
+        }
+    }
+    for (; i < t->n_wires; ++i) {
+        if ((t->end1[i] == e || t->end2[i] == e) && !WIRE_IS_DEAD(t, i)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// Last wire before end with an end at e, or -1
+int find_last_wire_with_endpoint(const wire_table_t *t, endpoint_t e, int end)
+{
+    int i = end > t->n_wires ? t->n_wires : end;
+    for (; i - 4 >= 0; i -= 4) {
+        int mask = endpoint_match_mask(t, e, i - 4);
+        if (mask != 0) {
+            for (int k = 3; k >= 0; --k) {
+                if ((mask & (1 << k)) && !WIRE_IS_DEAD(t, i - 4 + k)) {
+                    return i - 4 + k;
+                }
+            }
+        }
+    }
+    for (--i; i >= 0; --i) {
+        if ((t->end1[i] == e || t->end2[i] == e) && !WIRE_IS_DEAD(t, i)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+void free_wire_table(wire_table_t *t)
+{
+    free(t->dead);
+    free(t->end1);
+    free(t->end2);
+    free(t->colour);
+    free(t->thickness);
+    free(t->straight_fraction);
+    free(t->variants);
+    free(t->overrides);
+    free(t->generation);
+    free(t->changed_chunks);
+    memset(t, 0, sizeof *t);
+}
+
+uint32_t next_generation(program_state_t *state)
+{
+    // Skip 0 on wrap-around; it marks a null handle
+    if (++state->generation_counter == 0) {
+        ++state->generation_counter;
+    }
+    return state->generation_counter;
+}
+
+handle_t connector_handle(const harness_description_t *hd, int connector_index)
+{
+    if (connector_index < 0 || connector_index >= hd->n_connector_descriptions) {
+        return NULL_HANDLE;
+    }
+    return (handle_t){(uint32_t)connector_index, hd->connector_descriptions[connector_index].generation};
+}
+
+connector_description_t *resolve_connector(harness_description_t *hd, handle_t h)
+{
+    if (h.generation == 0 || h.index >= (uint32_t)hd->n_connector_descriptions) {
+        return NULL;
+    }
+    connector_description_t *cd = &hd->connector_descriptions[h.index];
+    if (cd->generation != h.generation) {
+        return NULL;
+    }
+    return cd;
+}
+
+handle_t pin_handle(const harness_description_t *hd, int connector_index, int pin_index)
+{
+    if (connector_index < 0 || connector_index >= hd->n_connector_descriptions || pin_index < 0 || pin_index >= hd->connector_descriptions[connector_index].n_pins) {
+        return NULL_HANDLE;
+    }
+    return (handle_t){PIN_HANDLE_INDEX(connector_index, pin_index), hd->connector_descriptions[connector_index].generation};
+}
+
+// Also returns the pin's connector through cd when cd is not NULL
+pin_t *resolve_pin(harness_description_t *hd, handle_t h, connector_description_t **cd)
+{
+    connector_description_t *c = resolve_connector(hd, (handle_t){h.index >> 16, h.generation});
+    uint32_t pin_index = h.index & 0xFFFF;
+    if (c == NULL || pin_index >= (uint32_t)c->n_pins) {
+        return NULL;
+    }
+    if (cd != NULL) {
+        *cd = c;
+    }
+    return &c->pins[pin_index];
+}
+
+handle_t wire_handle(const wire_table_t *t, int index)
+{
+    if (index < 0 || index >= t->n_wires || WIRE_IS_DEAD(t, index)) {
+        return NULL_HANDLE;
+    }
+    return (handle_t){(uint32_t)index, t->generation[index]};
+}
+
+// Returns the wire's current row, or -1 if it no longer exists
+int resolve_wire(const wire_table_t *t, handle_t h)
+{
+    if (h.generation == 0 || h.index >= (uint32_t)t->n_wires || WIRE_IS_DEAD(t, h.index) || t->generation[h.index] != h.generation) {
+        return -1;
+    }
+    return (int)h.index;
+}
+
+// Follows a wire handle through a compaction remap (see compact_wires())
+handle_t remap_wire_handle(handle_t h, const int *remap)
+{
+    if (h.generation == 0 || remap[h.index] < 0) {
+        return NULL_HANDLE;
+    }
+    return (handle_t){(uint32_t)remap[h.index], h.generation};
+}
+
+// Assigns harness-wide pin ids in connector order
+void index_harness_pins(harness_description_t *hd)
+{
+    int n_pins = 0;
+    for (int i = 0; i < hd->n_connector_descriptions; ++i) {
+        hd->connector_descriptions[i].first_pin = n_pins;
+        n_pins += hd->connector_descriptions[i].n_pins;
+    }
+    hd->n_pins = n_pins;
+}
+
+int reserve_view_state(view_state_t *v, int n_pins, int n_wires)
+{
+    void *mem = NULL;
+    int n_pin_words = BITSET_WORDS(n_pins);
+    if (n_pin_words > v->max_pin_words) {
+        mem = realloc(v->pin_highlighted, sizeof *v->pin_highlighted * n_pin_words);
+        if (mem == NULL) {
+            fprintf(stderr, "Error allocating memory\n");
+            return 1;
+        }
+        v->pin_highlighted = mem;
+        mem = realloc(v->pin_under_pointer, sizeof *v->pin_under_pointer * n_pin_words);
+        if (mem == NULL) {
+            fprintf(stderr, "Error allocating memory\n");
+            return 1;
+        }
+        v->pin_under_pointer = mem;
+        memset(&v->pin_highlighted[v->max_pin_words], 0, sizeof *v->pin_highlighted * (n_pin_words - v->max_pin_words));
+        memset(&v->pin_under_pointer[v->max_pin_words], 0, sizeof *v->pin_under_pointer * (n_pin_words - v->max_pin_words));
+        v->max_pin_words = n_pin_words;
+    }
+    int n_wire_words = BITSET_WORDS(n_wires);
+    if (n_wire_words > v->max_wire_words) {
+        mem = realloc(v->wire_highlighted, sizeof *v->wire_highlighted * n_wire_words);
+        if (mem == NULL) {
+            fprintf(stderr, "Error allocating memory\n");
+            return 1;
+        }
+        v->wire_highlighted = mem;
+        memset(&v->wire_highlighted[v->max_wire_words], 0, sizeof *v->wire_highlighted * (n_wire_words - v->max_wire_words));
+        v->max_wire_words = n_wire_words;
+    }
+
+    return 0;
+}
+
+void clear_view_state(view_state_t *v, int n_pins, int n_wires)
+{
+    if (v->max_pin_words > 0) {
+        memset(v->pin_highlighted, 0, sizeof *v->pin_highlighted * BITSET_WORDS(n_pins));
+        memset(v->pin_under_pointer, 0, sizeof *v->pin_under_pointer * BITSET_WORDS(n_pins));
+    }
+    if (v->max_wire_words > 0) {
+        memset(v->wire_highlighted, 0, sizeof *v->wire_highlighted * BITSET_WORDS(n_wires));
+    }
+    v->n_hovered_pins = 0;
+    v->wire_under_pointer = NULL_HANDLE;
+}
+
+void free_view_state(view_state_t *v)
+{
+    free(v->pin_highlighted);
+    free(v->pin_under_pointer);
+    free(v->wire_highlighted);
+    memset(v, 0, sizeof *v);
+}
+
+// Binary search of the override table. Returns the entry for wire, or
+// -(insertion point) - 1 if the wire uses the defaults.
+int find_wire_override(const wire_table_t *t, int wire)
+{
+    int lo = 0;
+    int hi = t->n_overrides;
+    int mid = 0;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (t->overrides[mid].wire < wire) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < t->n_overrides && t->overrides[lo].wire == wire) {
+        return lo;
+    }
+
+    return -lo - 1;
+}
+
+// Sets or clears a wire's gauge and length overrides; 0 means default.
+// New wires are appended at the end of the table, so inserting is normally
+// an append here too.
+int set_wire_override(wire_table_t *t, int wire, string_id_t gauge, string_id_t length)
+{
+    int k = find_wire_override(t, wire);
+    if (k >= 0) {
+        t->overrides_changed = 1;
+        if (gauge == 0 && length == 0) {
+            memmove(&t->overrides[k], &t->overrides[k + 1], sizeof *t->overrides * (t->n_overrides - k - 1));
+            t->n_overrides--;
+        } else {
+            t->overrides[k].gauge = gauge;
+            t->overrides[k].length = length;
+        }
+        return 0;
+    }
+    if (gauge == 0 && length == 0) {
+        return 0;
+    }
+    if (t->n_overrides == t->max_overrides) {
+        int max_overrides = t->max_overrides == 0 ? 16 : t->max_overrides * 2;
+        void *mem = realloc(t->overrides, sizeof *t->overrides * max_overrides);
+        if (mem == NULL) {
+            fprintf(stderr, "Error allocating memory\n");
+            return 1;
+        }
+        t->overrides = mem;
+        t->max_overrides = max_overrides;
+    }
+    k = -k - 1;
+    memmove(&t->overrides[k + 1], &t->overrides[k], sizeof *t->overrides * (t->n_overrides - k));
+    t->overrides[k] = (wire_override_t){.wire = wire, .gauge = gauge, .length = length};
+    t->n_overrides++;
+    t->overrides_changed = 1;
+
+    return 0;
+}
+
+// Returns the variant's index, declaring it if the name is new, or -1 if the
+// harness already has MAX_VARIANTS variants
+int declare_variant(program_state_t *state, harness_description_t *h, const char *name)
+{
+    string_id_t id = intern_string(&state->strings, name);
+    for (int i = 0; i < h->n_variants; ++i) {
+        if (h->variant_names[i] == id) {
+            return i;
+        }
+    }
+    if (h->n_variants >= MAX_VARIANTS) {
+        fprintf(stderr, "%s: too many variants\n", string_from_id(&state->strings, h->name));
+        return -1;
+    }
+    h->variant_names[h->n_variants] = id;
+
+    return h->n_variants++;
+}
+
+void parse_harness_variants(program_state_t *state, char *variants, harness_description_t *h)
+{
+    char *token, *string, *tofree;
+    tofree = string = strdup(variants);
+
+    while ((token = strsep(&string, ", ")) != NULL) {
+        if (strlen(token) > 0) {
+            declare_variant(state, h, token);
+        }
+    }
+
+    free(tofree);
+}
+
+// Cuts a trailing ",@<variant>|<variant>..." field off an entry. Returns the
+// variant list, or NULL if the entry is untagged.
+char *split_variant_tags(char *entry)
+{
+    char *tags = strstr(entry, ",@");
+    if (tags == NULL) {
+        return NULL;
+    }
+    *tags = '\0';
+
+    return tags + 2;
+}
+
+variant_mask_t parse_variant_tags(program_state_t *state, harness_description_t *h, char *tags)
+{
+    variant_mask_t variants = 0;
+    char *token = NULL;
+    int index = 0;
+    while ((token = strsep(&tags, "|")) != NULL) {
+        if (strlen(token) == 0) {
+            continue;
+        }
+        index = declare_variant(state, h, token);
+        if (index >= 0) {
+            variants |= VARIANT_BIT(index);
+        }
+    }
+
+    return variants == 0 ? ALL_VARIANTS : variants;
+}
+
+variant_mask_t declared_variants(const harness_description_t *hd)
+{
+    if (hd->n_variants >= MAX_VARIANTS) {
+        return ALL_VARIANTS;
+    }
+
+    return VARIANT_BIT(hd->n_variants) - 1;
+}
+
+variant_mask_t selected_variants(const program_state_t *state, const harness_description_t *hd)
+{
+    if (state->variant_index < 0 || state->variant_index >= hd->n_variants) {
+        return ALL_VARIANTS;
+    }
+
+    return VARIANT_BIT(state->variant_index);
+}
+
+// Steps through the current harness's variants and back to showing them all
+void select_next_variant(program_state_t *state)
+{
+    if (state->harness_index < 0 || state->harness_index >= state->n_harnesses) {
+        return;
+    }
+    harness_description_t *hd = &state->harness_descriptions[state->harness_index];
+    state->variant_index++;
+    if (state->variant_index >= hd->n_variants) {
+        state->variant_index = -1;
+    }
+    reset_pin_under_pointer_states(state);
+}
+
+// A wire is in a variant when it and both of its connectors are
+int wire_in_variants(const harness_description_t *hd, int index, variant_mask_t variants)
+{
+    const wire_table_t *t = &hd->wires;
+    variant_mask_t mask = t->variants[index] & variants;
+    int c1 = ENDPOINT_CONNECTOR(t->end1[index]) - 1;
+    int c2 = ENDPOINT_CONNECTOR(t->end2[index]) - 1;
+    if (c1 >= 0 && c1 < hd->n_connector_descriptions) {
+        mask &= hd->connector_descriptions[c1].variants;
+    }
+    if (c2 >= 0 && c2 < hd->n_connector_descriptions) {
+        mask &= hd->connector_descriptions[c2].variants;
+    }
+
+    return mask != 0;
+}
+
+int find_last_wire_in_variants(const harness_description_t *hd, endpoint_t e, variant_mask_t variants)
+{
+    int i = find_last_wire_with_endpoint(&hd->wires, e, hd->wires.n_wires);
+    while (i >= 0 && !wire_in_variants(hd, i, variants)) {
+        i = find_last_wire_with_endpoint(&hd->wires, e, i);
+    }
+
+    return i;
+}
+
+// Declares the next splice: "S<n>[,<name>]". Splices are numbered in
+// declaration order, like connectors.
+int parse_splice_entry(program_state_t *state, char *entry, harness_description_t *h)
+{
+    char *token, *string, *tofree;
+    tofree = string = strdup(entry);
+
+    const char *harness_name = string_from_id(&state->strings, h->name);
+    while (*string == ' ') {
+        string++;
+    }
+    token = strsep(&string, ",");
+    if (token == NULL || token[0] != 'S') {
+        fprintf(stderr, "%s: expected splice S<n>[,<name>]\n", harness_name);
+        free(tofree);
+        return 1;
+    }
+    if (atoi(token + 1) != h->n_splices + 1) {
+        fprintf(stderr, "%s: splice %s declared out of order; numbering it S%d\n", harness_name, token, h->n_splices + 1);
+    }
+    if (h->n_splices >= MAX_ENDPOINT_NUMBER) {
+        fprintf(stderr, "%s: too many splices\n", harness_name);
+        free(tofree);
+        return 1;
+    }
+    void *mem = realloc(h->splices, sizeof *h->splices * (h->n_splices + 1));
+    if (mem == NULL) {
+        fprintf(stderr, "Error allocating memory\n");
+        free(tofree);
+        return 2;
+    }
+    h->splices = mem;
+    splice_t *s = &h->splices[h->n_splices++];
+    memset(s, 0, sizeof *s);
+    token = strsep(&string, ",");
+    if (token != NULL && strlen(token) > 0) {
+        s->name = intern_string(&state->strings, token);
+    }
+
+    free(tofree);
+
+    return 0;
+}
+
+// Rebuilds the splice adjacency if the wiring has changed since it was built
+int update_splice_graph(harness_description_t *hd)
+{
+    splice_graph_t *g = &hd->splice_graph;
+    wire_table_t *t = &hd->wires;
+    if (g->offsets != NULL && g->version == t->version && g->n_splices == hd->n_splices) {
+        return 0;
+    }
+
+    void *mem = realloc(g->offsets, sizeof *g->offsets * (hd->n_splices + 1));
+    if (mem == NULL) {
+        fprintf(stderr, "Error allocating memory\n");
+        return 1;
+    }
+    g->offsets = mem;
+    g->n_splices = hd->n_splices;
+    if (build_csr(hd->n_splices, t->n_wires, splice_wire_keys, hd, g->offsets, &g->wires, &g->max_wires) != 0) {
+        free(g->offsets);
+        g->offsets = NULL;
+        return 1;
+    }
+    g->version = t->version;
+
+    return 0;
+}
+
+// A wire is at each splice it ends on, once even if both ends are there
+int splice_wire_keys(const void *context, int wire, int *keys)
+{
+    const harness_description_t *hd = context;
+    const wire_table_t *t = &hd->wires;
+    if (WIRE_IS_DEAD(t, wire)) {
+        return 0;
+    }
+    int n = 0;
+    if (ENDPOINT_IS_SPLICE(t->end1[wire])) {
+        keys[n++] = ENDPOINT_PIN(t->end1[wire]) - 1;
+    }
+    if (ENDPOINT_IS_SPLICE(t->end2[wire]) && t->end2[wire] != t->end1[wire]) {
+        keys[n++] = ENDPOINT_PIN(t->end2[wire]) - 1;
+    }
+
+    return n;
+}
+
+void free_splice_graph(splice_graph_t *g)
+{
+    free(g->offsets);
+    free(g->wires);
+    memset(g, 0, sizeof *g);
+}
+
+// Where a wire meets a connector pin. Returns non-zero if the endpoint's
+// connector does not exist.
+int pin_anchor(program_state_t *state, harness_t *h, endpoint_t e, Vector2 *anchor)
+{
+    int connector_index = ENDPOINT_CONNECTOR(e) - 1;
+    if (connector_index < 0 || connector_index >= h->n_connectors) {
+        return 1;
+    }
+    connector_t *c = &h->connectors[connector_index];
+    anchor->x = c->outline.x;
+    if (!c->facing_left) {
+        anchor->x += c->outline.width;
+    }
+    int row = ENDPOINT_PIN(e);
+    if (c->pin_view != PIN_VIEW_ALL) {
+        // Hidden pins attach to the row standing for them
+        int pin_id = endpoint_vertex(h->description, e);
+        if (pin_id < 0) {
+            return 1;
+        }
+        row = h->pin_rows[pin_id] + 1;
+    }
+    anchor->y = c->outline.y + CONNECTOR_OUTLINE_GAP + state->font_sizes[c->font] * 1.5 + (float)(row * c->line_height);
+
+    return 0;
+}
+
+// Puts each splice in the gap between columns nearest the pins it feeds, and
+// spreads the splices in each gap across it, each trunk spanning its pins
+void layout_splices(program_state_t *state, harness_t *h, variant_mask_t variants)
+{
+    harness_description_t *hd = h->description;
+    splice_graph_t *g = &hd->splice_graph;
+    wire_table_t *wires = &hd->wires;
+    if (g->offsets == NULL || g->n_splices != hd->n_splices) {
+        return;
+    }
+    splice_layout_t *sl = NULL;
+    Vector2 anchor = {0};
+    int wire = 0;
+    int n_ends = 0;
+    endpoint_t e = 0;
+    float sum_x = 0.0;
+    float distance = 0.0;
+    int n_in_gap[MAX_COLUMNS] = {0};
+    for (int s = 0; s < hd->n_splices; ++s) {
+        sl = &h->splices[s];
+        sl->top = 0;
+        sl->bottom = 0;
+        sl->gap = 0;
+        sum_x = 0.0;
+        n_ends = 0;
+        for (int k = g->offsets[s]; k < g->offsets[s + 1]; ++k) {
+            wire = g->wires[k];
+            if (!wire_in_variants(hd, wire, variants)) {
+                continue;
+            }
+            e = ENDPOINT_IS_SPLICE(wires->end1[wire]) ? wires->end2[wire] : wires->end1[wire];
+            if (ENDPOINT_IS_SPLICE(e) || pin_anchor(state, h, e, &anchor) != 0) {
+                continue;
+            }
+            if (n_ends == 0 || anchor.y < sl->top) {
+                sl->top = anchor.y;
+            }
+            if (n_ends == 0 || anchor.y > sl->bottom) {
+                sl->bottom = anchor.y;
+            }
+            sum_x += anchor.x;
+            n_ends++;
+        }
+        for (int k = 1; k < h->n_gaps && n_ends > 0; ++k) {
+            distance = fabsf(h->gaps[k] + CONNECTOR_SPACING_X / 2 - sum_x / n_ends);
+            if (distance < fabsf(h->gaps[sl->gap] + CONNECTOR_SPACING_X / 2 - sum_x / n_ends)) {
+                sl->gap = k;
+            }
+        }
+        n_in_gap[sl->gap]++;
+    }
+    int rank[MAX_COLUMNS] = {0};
+    for (int s = 0; s < hd->n_splices; ++s) {
+        sl = &h->splices[s];
+        rank[sl->gap]++;
+        sl->x = h->gaps[sl->gap] + (float)CONNECTOR_SPACING_X * (float)rank[sl->gap] / (float)(n_in_gap[sl->gap] + 1);
+    }
+}
+
+int find_splice_under_pointer(program_state_t *state, harness_t *h, variant_mask_t variants)
+{
+    harness_description_t *hd = h->description;
+    splice_graph_t *g = &hd->splice_graph;
+    if (g->offsets == NULL || g->n_splices != hd->n_splices) {
+        return -1;
+    }
+    splice_layout_t *sl = NULL;
+    int in_variant = 0;
+    for (int s = 0; s < hd->n_splices; ++s) {
+        sl = &h->splices[s];
+        Rectangle trunk = {sl->x - SPLICE_HIT_HALF_WIDTH, sl->top - SPLICE_HIT_HALF_WIDTH, 2 * SPLICE_HIT_HALF_WIDTH, sl->bottom - sl->top + 2 * SPLICE_HIT_HALF_WIDTH};
+        if (!CheckCollisionPointRec(state->mouse_position, trunk)) {
+            continue;
+        }
+        // Only splices that are drawn can be hovered
+        in_variant = 0;
+        for (int k = g->offsets[s]; k < g->offsets[s + 1] && !in_variant; ++k) {
+            in_variant = wire_in_variants(hd, g->wires[k], variants);
+        }
+        if (in_variant) {
+            return s;
+        }
+    }
+
+    return -1;
+}
+
+void draw_splices(program_state_t *state, harness_t *h, variant_mask_t variants)
+{
+    harness_description_t *hd = h->description;
+    splice_graph_t *g = &hd->splice_graph;
+    if (g->offsets == NULL || g->n_splices != hd->n_splices) {
+        return;
+    }
+    Font font = state->fonts[CONNECTOR_FONT];
+    float font_size = state->font_sizes[CONNECTOR_FONT];
+    Color highlighted_color = get_color_from_string(DEFAULT_HIGHLIGHT_COLOR);
+    char label[LINE_MAX_LEN] = {0};
+    splice_layout_t *sl = NULL;
+    int n_wires = 0;
+    int highlighted = 0;
+    int wire = 0;
+    for (int s = 0; s < hd->n_splices; ++s) {
+        sl = &h->splices[s];
+        n_wires = 0;
+        highlighted = 0;
+        for (int k = g->offsets[s]; k < g->offsets[s + 1]; ++k) {
+            wire = g->wires[k];
+            if (wire_in_variants(hd, wire, variants)) {
+                n_wires++;
+                highlighted |= BITSET_TEST(state->view.wire_highlighted, wire);
+            }
+        }
+        if (n_wires == 0) {
+            continue;
+        }
+        Color color = highlighted ? highlighted_color : state->foreground_color;
+        DrawLineEx((Vector2){sl->x, sl->top}, (Vector2){sl->x, sl->bottom}, DEFAULT_WIRE_THICKNESS + 1, color);
+        DrawCircleV((Vector2){sl->x, sl->top}, SPLICE_DOT_RADIUS, color);
+        DrawCircleV((Vector2){sl->x, sl->bottom}, SPLICE_DOT_RADIUS, color);
+        format_splice_label(state, hd, s, label, LINE_MAX_LEN);
+        DrawTextEx(font, label, (Vector2){sl->x - sl->label_width / 2, sl->top - font_size - 2 * SPLICE_DOT_RADIUS}, font_size, FONT_SPACING, color);
+    }
+}
+
+// A wire with a splice end is drawn straight: from its pin across to the
+// splice trunk, or from trunk to trunk between two splices
+void draw_splice_branch(program_state_t *state, harness_t *h, int wire)
+{
+    harness_description_t *hd = h->description;
+    wire_table_t *wires = &hd->wires;
+    endpoint_t ends[2] = {wires->end1[wire], wires->end2[wire]};
+    Vector2 anchors[2] = {0};
+    int s = 0;
+    for (int k = 0; k < 2; ++k) {
+        if (ENDPOINT_IS_SPLICE(ends[k])) {
+            continue;
+        }
+        if (pin_anchor(state, h, ends[k], &anchors[k]) != 0) {
+            fprintf(stderr, "Invalid connector number for wire %d\n", wire + 1);
+            return;
+        }
+    }
+    for (int k = 0; k < 2; ++k) {
+        if (!ENDPOINT_IS_SPLICE(ends[k])) {
+            continue;
+        }
+        s = ENDPOINT_PIN(ends[k]) - 1;
+        if (s < 0 || s >= hd->n_splices) {
+            fprintf(stderr, "Invalid splice number for wire %d\n", wire + 1);
+            return;
+        }
+        anchors[k].x = h->splices[s].x;
+        if (ENDPOINT_IS_SPLICE(ends[1 - k])) {
+            anchors[k].y = (h->splices[s].top + h->splices[s].bottom) / 2;
+        } else {
+            anchors[k].y = anchors[1 - k].y;
+        }
+    }
+    Vector2 points[] = {anchors[0], anchors[0], anchors[1], anchors[1]};
+    draw_wire_spline(state, wires, wire, points);
+}
+
+void draw_wire_spline(program_state_t *state, const wire_table_t *wires, int wire, const Vector2 *points)
+{
+    float thickness = wires->thickness[wire];
+    Color outline_wire_color = state->foreground_color;
+    float outline_wire_thickness = thickness + 0.5;
+    if (BITSET_TEST(state->view.wire_highlighted, wire)) {
+        outline_wire_color = get_color_from_string(DEFAULT_HIGHLIGHT_COLOR);
+        outline_wire_thickness = thickness + 4;
+    }
+    if (state->orthogonal) {
+        DrawSplineLinear(points, 4, outline_wire_thickness, outline_wire_color);
+        DrawSplineLinear(points, 4, thickness, get_color_from_string(string_from_id(&state->strings, wires->colour[wire])));
+        return;
+    }
+    DrawSplineBezierCubic(points, 4, outline_wire_thickness, outline_wire_color);
+    DrawSplineBezierCubic(points, 4, thickness, get_color_from_string(string_from_id(&state->strings, wires->colour[wire])));
+}
+
+void write_endpoint(FILE *fp, int connector, int pin)
+{
+    if (connector == SPLICE_CONNECTOR) {
+        fprintf(fp, "S%d", pin);
+    } else {
+        fprintf(fp, "%d,%d", connector, pin);
+    }
+}
+
+// Returns the net vertex of a wire end, or -1 if it names no pin or splice
+int endpoint_vertex(const harness_description_t *hd, endpoint_t e)
+{
+    if (ENDPOINT_IS_SPLICE(e)) {
+        int s = ENDPOINT_PIN(e) - 1;
+        if (s < 0 || s >= hd->n_splices) {
+            return -1;
+        }
+        return hd->n_pins + s;
+    }
+    int connector_index = ENDPOINT_CONNECTOR(e) - 1;
+    if (connector_index < 0 || connector_index >= hd->n_connector_descriptions) {
+        return -1;
+    }
+    const connector_description_t *cd = &hd->connector_descriptions[connector_index];
+    int number = ENDPOINT_PIN(e);
+    // Pins are listed in increasing order
+    int lo = 0;
+    int hi = cd->n_pins;
+    int mid = 0;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (cd->pins[mid].number < number) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < cd->n_pins && cd->pins[lo].number == number) {
+        return cd->first_pin + lo;
+    }
+    // Fall back to a scan in case the file listed them out of order
+    for (int k = 0; k < cd->n_pins; ++k) {
+        if (cd->pins[k].number == number) {
+            return cd->first_pin + k;
+        }
+    }
+
+    return -1;
+}
+
+int nets_current(const harness_description_t *hd, variant_mask_t variants)
+{
+    const net_table_t *nets = &hd->nets;
+
+    return nets->parent != NULL && nets->version == hd->wires.version && nets->variants == variants && nets->n_vertices == hd->n_pins + hd->n_splices;
+}
+
+// Recomputes every net from scratch unless they are already current
+int update_nets(harness_description_t *hd, variant_mask_t variants)
+{
+    if (nets_current(hd, variants)) {
+        return 0;
+    }
+    net_table_t *nets = &hd->nets;
+    int n_vertices = hd->n_pins + hd->n_splices;
+    if (nets->parent == NULL || nets->n_vertices != n_vertices) {
+        void *mem = NULL;
+        int n = n_vertices > 0 ? n_vertices : 1;
+#define GROW_NET_COLUMN(column, count) \
+        mem = realloc(nets->column, sizeof *nets->column * (count)); \
+        if (mem == NULL) { \
+            fprintf(stderr, "Error allocating memory\n"); \
+            free_net_table(nets); \
+            return 1; \
+        } \
+        nets->column = mem;
+        GROW_NET_COLUMN(parent, n);
+        GROW_NET_COLUMN(rank, n);
+        GROW_NET_COLUMN(next, n);
+        GROW_NET_COLUMN(mark, BITSET_WORDS(n));
+        GROW_NET_COLUMN(members, n);
+#undef GROW_NET_COLUMN
+        nets->n_vertices = n_vertices;
+    }
+    for (int v = 0; v < n_vertices; ++v) {
+        nets->parent[v] = v;
+        nets->rank[v] = 0;
+        nets->next[v] = v;
+    }
+    memset(nets->mark, 0, sizeof *nets->mark * BITSET_WORDS(n_vertices > 0 ? n_vertices : 1));
+    nets->variants = variants;
+    wire_table_t *t = &hd->wires;
+    for (int i = 0; i < t->n_wires; ++i) {
+        if (!WIRE_IS_DEAD(t, i)) {
+            add_wire_to_nets(hd, i);
+        }
+    }
+    nets->version = t->version;
+
+    return 0;
+}
+
+int net_find(net_table_t *nets, int v)
+{
+    // Path halving
+    while (nets->parent[v] != v) {
+        nets->parent[v] = nets->parent[nets->parent[v]];
+        v = nets->parent[v];
+    }
+
+    return v;
+}
+
+void net_union(net_table_t *nets, int a, int b)
+{
+    a = net_find(nets, a);
+    b = net_find(nets, b);
+    if (a == b) {
+        return;
+    }
+    if (nets->rank[a] < nets->rank[b]) {
+        int tmp = a;
+        a = b;
+        b = tmp;
+    }
+    nets->parent[b] = a;
+    if (nets->rank[a] == nets->rank[b]) {
+        nets->rank[a]++;
+    }
+    // Splice the two member lists together
+    int tmp = nets->next[a];
+    nets->next[a] = nets->next[b];
+    nets->next[b] = tmp;
+}
+
+// Joins the nets at both ends of a wire, if it is in the nets' variants
+void add_wire_to_nets(harness_description_t *hd, int wire)
+{
+    if (!wire_in_variants(hd, wire, hd->nets.variants)) {
+        return;
+    }
+    int a = endpoint_vertex(hd, hd->wires.end1[wire]);
+    int b = endpoint_vertex(hd, hd->wires.end2[wire]);
+    if (a >= 0 && b >= 0) {
+        net_union(&hd->nets, a, b);
+    }
+}
+
+// Recomputes the net containing vertex v after wires were taken out of it.
+// Only that net's vertices are reset, and only the wires filed under them
+// (see vertex_wires_t) are joined again.
+void split_net(harness_description_t *hd, int v)
+{
+    net_table_t *nets = &hd->nets;
+    wire_table_t *t = &hd->wires;
+    if (v < 0 || v >= nets->n_vertices) {
+        return;
+    }
+    vertex_wires_t *vw = &hd->vertex_wires;
+    if (update_vertex_wires(hd) != 0) {
+        // Leave the nets to be computed again from scratch
+        free_net_table(nets);
+        return;
+    }
+    int n_members = 0;
+    int u = v;
+    int next = 0;
+    do {
+        next = nets->next[u];
+        nets->members[n_members++] = u;
+        BITSET_SET(nets->mark, u);
+        nets->parent[u] = u;
+        nets->rank[u] = 0;
+        nets->next[u] = u;
+        u = next;
+    } while (u != v);
+
+    // Any wire still in the net has both ends among its vertices
+    int wire = 0;
+    int a = 0;
+    int b = 0;
+    for (int k = 0; k < n_members; ++k) {
+        u = nets->members[k];
+        for (int j = vw->offsets[u]; j < vw->offsets[u + 1]; ++j) {
+            wire = vw->wires[j];
+            if (WIRE_IS_DEAD(t, wire) || !wire_in_variants(hd, wire, nets->variants)) {
+                continue;
+            }
+            a = endpoint_vertex(hd, t->end1[wire]);
+            b = endpoint_vertex(hd, t->end2[wire]);
+            if (a >= 0 && b >= 0) {
+                net_union(nets, a, b);
+            }
+        }
+    }
+    for (wire = vw->n_rows; wire < t->n_wires; ++wire) {
+        if (WIRE_IS_DEAD(t, wire) || !wire_in_variants(hd, wire, nets->variants)) {
+            continue;
+        }
+        a = endpoint_vertex(hd, t->end1[wire]);
+        b = endpoint_vertex(hd, t->end2[wire]);
+        if (a >= 0 && b >= 0 && (BITSET_TEST(nets->mark, a) || BITSET_TEST(nets->mark, b))) {
+            net_union(nets, a, b);
+        }
+    }
+    for (int k = 0; k < n_members; ++k) {
+        BITSET_CLEAR(nets->mark, nets->members[k]);
+    }
+}
+
+// Net id of a harness-wide pin id, valid until the wiring next changes
+int pin_net(harness_description_t *hd, int pin_id)
+{
+    return net_find(&hd->nets, pin_id);
+}
+
+void free_net_table(net_table_t *nets)
+{
+    free(nets->parent);
+    free(nets->rank);
+    free(nets->next);
+    free(nets->mark);
+    free(nets->members);
+    memset(nets, 0, sizeof *nets);
+}
+
+// Marks every pin and wire on the nets of the pins and splice under the
+// pointer. Pins under the pointer were already marked by the layout pass.
+void highlight_nets(program_state_t *state, harness_t *h, variant_mask_t variants)
+{
+    harness_description_t *hd = h->description;
+    view_state_t *view = &state->view;
+    if (update_nets(hd, variants) != 0) {
+        return;
+    }
+    net_table_t *nets = &hd->nets;
+
+    // Distinct roots, sorted so the set can be compared with the cached one
+    int roots[MAX_LIT_NETS] = {0};
+    int n_roots = 0;
+    int root = 0;
+    int s = find_splice_under_pointer(state, h, variants);
+    for (int i = 0; i <= view->n_hovered_pins; ++i) {
+        if (i < view->n_hovered_pins) {
+            root = pin_net(hd, view->hovered_pins[i]);
+        } else if (s >= 0) {
+            root = net_find(nets, hd->n_pins + s);
+        } else {
+            break;
+        }
+        int k = n_roots;
+        while (k > 0 && roots[k - 1] > root) {
+            k--;
+        }
+        if ((k > 0 && roots[k - 1] == root) || n_roots == MAX_LIT_NETS) {
+            continue;
+        }
+        memmove(&roots[k + 1], &roots[k], sizeof *roots * (n_roots - k));
+        roots[k] = root;
+        n_roots++;
+    }
+    if (n_roots == 0 || update_lit_set(h, roots, n_roots, variants) != 0) {
+        return;
+    }
+
+    for (int i = 0; i < h->lit.n_pins; ++i) {
+        BITSET_SET(view->pin_highlighted, h->lit.pins[i]);
+    }
+    for (int i = 0; i < h->lit.n_wires; ++i) {
+        BITSET_SET(view->wire_highlighted, h->lit.wires[i]);
+    }
+}
+
+void mark_harness_edited(program_state_t *state, harness_description_t *hd)
+{
+    hd->changed = 1;
+    hd->revision = ++state->revision;
+}
+
+// Copies one chunk of rows, deleted ones included
+wire_chunk_t *copy_wire_chunk(const wire_table_t *t, int chunk)
+{
+    wire_chunk_t *wc = malloc(sizeof *wc);
+    if (wc == NULL) {
+        fprintf(stderr, "Error allocating memory\n");
+        return NULL;
+    }
+    atomic_init(&wc->refs, 1);
+    int first = chunk * SNAPSHOT_WIRE_CHUNK_ROWS;
+    int n = t->n_wires - first < SNAPSHOT_WIRE_CHUNK_ROWS ? t->n_wires - first : SNAPSHOT_WIRE_CHUNK_ROWS;
+#define COPY_WIRE_COLUMN(column) memcpy(wc->column, &t->column[first], sizeof *wc->column * n)
+    COPY_WIRE_COLUMN(end1);
+    COPY_WIRE_COLUMN(end2);
+    COPY_WIRE_COLUMN(colour);
+    COPY_WIRE_COLUMN(thickness);
+    COPY_WIRE_COLUMN(straight_fraction);
+    COPY_WIRE_COLUMN(variants);
+    COPY_WIRE_COLUMN(generation);
+#undef COPY_WIRE_COLUMN
+    memcpy(wc->dead, &t->dead[first / 64], sizeof *wc->dead * BITSET_WORDS(n));
+
+    return wc;
+}
+
+harness_snapshot_t *snapshot_harness(const harness_description_t *hd, const harness_snapshot_t *previous)
+{
+    harness_snapshot_t *hs = calloc(1, sizeof *hs);
+    if (hs == NULL) {
+        fprintf(stderr, "Error allocating memory\n");
+        return NULL;
+    }
+    atomic_init(&hs->refs, 1);
+    harness_description_t *copy = &hs->description;
+    *copy = *hd;
+    // Derived tables are not carried over
+    memset(&copy->splice_graph, 0, sizeof copy->splice_graph);
+    memset(&copy->vertex_wires, 0, sizeof copy->vertex_wires);
+    memset(&copy->nets, 0, sizeof copy->nets);
+    copy->connector_descriptions = NULL;
+    copy->changed_connector_blocks = NULL;
+    memset(&copy->wires, 0, sizeof copy->wires);
+    copy->wires.version = hd->wires.version;
+    copy->wires.compactions = hd->wires.compactions;
+    copy->wires.n_wires = hd->wires.n_wires;
+    copy->wires.n_dead = hd->wires.n_dead;
+
+    hs->n_connector_blocks = SNAPSHOT_CONNECTOR_BLOCKS(hd->n_connector_descriptions);
+    hs->n_wire_chunks = SNAPSHOT_WIRE_CHUNKS(hd->wires.n_wires);
+    hs->connector_blocks = calloc(hs->n_connector_blocks > 0 ? hs->n_connector_blocks : 1, sizeof *hs->connector_blocks);
+    hs->wire_chunks = calloc(hs->n_wire_chunks > 0 ? hs->n_wire_chunks : 1, sizeof *hs->wire_chunks);
+    if (hs->connector_blocks == NULL || hs->wire_chunks == NULL) {
+        fprintf(stderr, "Error allocating memory\n");
+        release_harness_snapshot(hs);
+        return NULL;
+    }
+
+    // Blocks and chunks not written since the previous snapshot was
+    // published are shared with it
+    int share_connectors = previous != NULL && hd->changed_connector_blocks != NULL && previous->description.n_connector_descriptions == hd->n_connector_descriptions;
+    int n = 0;
+    for (int b = 0; b < hs->n_connector_blocks; ++b) {
+        if (share_connectors && !BITSET_TEST(hd->changed_connector_blocks, b)) {
+            hs->connector_blocks[b] = previous->connector_blocks[b];
+            atomic_fetch_add(&hs->connector_blocks[b]->refs, 1);
+            continue;
+        }
+        hs->connector_blocks[b] = malloc(sizeof *hs->connector_blocks[b]);
+        if (hs->connector_blocks[b] == NULL) {
+            fprintf(stderr, "Error allocating memory\n");
+            release_harness_snapshot(hs);
+            return NULL;
+        }
+        atomic_init(&hs->connector_blocks[b]->refs, 1);
+        n = hd->n_connector_descriptions - b * SNAPSHOT_CONNECTOR_BLOCK_SIZE;
+        if (n > SNAPSHOT_CONNECTOR_BLOCK_SIZE) {
+            n = SNAPSHOT_CONNECTOR_BLOCK_SIZE;
+        }
+        memcpy(hs->connector_blocks[b]->connectors, &hd->connector_descriptions[b * SNAPSHOT_CONNECTOR_BLOCK_SIZE], sizeof *hd->connector_descriptions * n);
+    }
+    for (int k = 0; k < hs->n_wire_chunks; ++k) {
+        if (previous != NULL && k < previous->n_wire_chunks && !BITSET_TEST(hd->wires.changed_chunks, k)) {
+            hs->wire_chunks[k] = previous->wire_chunks[k];
+            atomic_fetch_add(&hs->wire_chunks[k]->refs, 1);
+            continue;
+        }
+        hs->wire_chunks[k] = copy_wire_chunk(&hd->wires, k);
+        if (hs->wire_chunks[k] == NULL) {
+            release_harness_snapshot(hs);
+            return NULL;
+        }
+    }
+    if (previous != NULL && !hd->wires.overrides_changed) {
+        hs->overrides = previous->overrides;
+        if (hs->overrides != NULL) {
+            atomic_fetch_add(&hs->overrides->refs, 1);
+        }
+    } else if (hd->wires.n_overrides > 0) {
+        hs->overrides = malloc(sizeof *hs->overrides + sizeof *hs->overrides->overrides * hd->wires.n_overrides);
+        if (hs->overrides == NULL) {
+            fprintf(stderr, "Error allocating memory\n");
+            release_harness_snapshot(hs);
+            return NULL;
+        }
+        atomic_init(&hs->overrides->refs, 1);
+        hs->overrides->n_overrides = hd->wires.n_overrides;
+        memcpy(hs->overrides->overrides, hd->wires.overrides, sizeof *hs->overrides->overrides * hd->wires.n_overrides);
+    }
+    if (hs->overrides != NULL) {
+        copy->wires.overrides = hs->overrides->overrides;
+        copy->wires.n_overrides = hs->overrides->n_overrides;
+    }
+
+    return hs;
+}
+
+void release_harness_snapshot(harness_snapshot_t *hs)
+{
+    if (hs == NULL || atomic_fetch_sub(&hs->refs, 1) != 1) {
+        return;
+    }
+    // Pins and splices belong to the live model, and blocks and chunks may
+    // still be shared with other snapshots
+    for (int b = 0; hs->connector_blocks != NULL && b < hs->n_connector_blocks; ++b) {
+        if (hs->connector_blocks[b] != NULL && atomic_fetch_sub(&hs->connector_blocks[b]->refs, 1) == 1) {
+            free(hs->connector_blocks[b]);
+        }
+    }
+    for (int k = 0; hs->wire_chunks != NULL && k < hs->n_wire_chunks; ++k) {
+        if (hs->wire_chunks[k] != NULL && atomic_fetch_sub(&hs->wire_chunks[k]->refs, 1) == 1) {
+            free(hs->wire_chunks[k]);
+        }
+    }
+    if (hs->overrides != NULL && atomic_fetch_sub(&hs->overrides->refs, 1) == 1) {
+        free(hs->overrides);
+    }
+    free(hs->connector_blocks);
+    free(hs->wire_chunks);
+    free(hs);
+}
+
+// Publishes a new snapshot if anything was edited since the last one.
+// Harnesses that have not changed are shared with the previous snapshot.
+int publish_snapshot(program_state_t *state)
+{
+    model_snapshot_t *old = atomic_load(&state->snapshot);
+    if (old != NULL && old->revision == state->revision && old->n_harnesses == state->n_harnesses) {
+        return 0;
+    }
+
+    model_snapshot_t *snap = calloc(1, sizeof *snap);
+    if (snap == NULL) {
+        fprintf(stderr, "Error allocating memory\n");
+        return 1;
+    }
+    atomic_init(&snap->refs, 1);
+    snap->revision = state->revision;
+    snap->dark_background = state->dark_background;
+    snap->strings.strings = state->strings.strings;
+    snap->strings.n_strings = state->strings.n_strings;
+    snap->n_harnesses = state->n_harnesses;
+    if (state->n_harnesses > 0) {
+        snap->harnesses = calloc(state->n_harnesses, sizeof *snap->harnesses);
+        if (snap->harnesses == NULL) {
+            fprintf(stderr, "Error allocating memory\n");
+            free(snap);
+            return 1;
+        }
+    }
+    harness_description_t *hd = NULL;
+    harness_snapshot_t *previous = NULL;
+    for (int i = 0; i < state->n_harnesses; ++i) {
+        hd = &state->harness_descriptions[i];
+        previous = old != NULL && i < old->n_harnesses ? old->harnesses[i] : NULL;
+        if (previous != NULL && previous->description.revision == hd->revision) {
+            atomic_fetch_add(&previous->refs, 1);
+            snap->harnesses[i] = previous;
+        } else {
+            snap->harnesses[i] = snapshot_harness(hd, previous);
+            if (snap->harnesses[i] == NULL) {
+                release_snapshot(snap);
+                return 1;
+            }
+        }
+    }
+
+    // Later snapshots are compared against this one. Readers of the old
+    // one keep it alive until they are done.
+    old = atomic_exchange(&state->snapshot, snap);
+    for (int i = 0; i < state->n_harnesses; ++i) {
+        if (old == NULL || i >= old->n_harnesses || snap->harnesses[i] != old->harnesses[i]) {
+            clear_snapshot_changes(&state->harness_descriptions[i]);
+        }
+    }
+    release_snapshot(old);
+
+    return 0;
+}
+
+// Returns a reference to the current snapshot, publishing one first if
+// needed. Render thread only.
+model_snapshot_t *acquire_snapshot(program_state_t *state)
+{
+    if (publish_snapshot(state) != 0) {
+        return NULL;
+    }
+    model_snapshot_t *snap = atomic_load(&state->snapshot);
+    if (snap != NULL) {
+        atomic_fetch_add(&snap->refs, 1);
+    }
+
+    return snap;
+}
+
+void release_snapshot(model_snapshot_t *snap)
+{
+    if (snap == NULL || atomic_fetch_sub(&snap->refs, 1) != 1) {
+        return;
+    }
+    for (int i = 0; i < snap->n_harnesses; ++i) {
+        release_harness_snapshot(snap->harnesses[i]);
+    }
+    free(snap->harnesses);
+    free(snap);
+}
+
+int write_snapshot(const model_snapshot_t *snap, const char *filename, int harness, int variant)
+{
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Error opening %s for writing\n", filename);
+        return 1;
+    }
+
+    int status = 0;
+    write_file_header(fp, snap->dark_background);
+    if (harness < 0) {
+        for (int i = 0; i < snap->n_harnesses && status == 0; ++i) {
+            status = write_harness_description(fp, &snap->strings, snap->harnesses[i], i + 1, -1);
+        }
+    } else if (harness < snap->n_harnesses) {
+        status = write_harness_description(fp, &snap->strings, snap->harnesses[harness], 1, variant);
+    } else {
+        status = 1;
+    }
+
+    fflush(fp);
+    fclose(fp);
+
+    return status;
+}
+
+// Starts writing the current snapshot in the background. Waits for an earlier
+// save that is still running, so saves land in the order they were asked for.
+int start_save_job(program_state_t *state, const char *filename, int harness, int variant)
+{
+    (void)finish_save_job(state);
+
+    save_job_t *job = &state->save_job;
+    job->snapshot = acquire_snapshot(state);
+    if (job->snapshot == NULL) {
+        return 1;
+    }
+    snprintf(job->filename, FILE_LINE_MAX_LEN, "%s", filename);
+    job->harness = harness;
+    job->variant = variant;
+    job->status = 0;
+    atomic_store(&job->done, 0);
+    if (pthread_create(&job->thread, NULL, run_save_job, job) != 0) {
+        // No thread to spare; save right here instead
+        int status = write_snapshot(job->snapshot, job->filename, harness, variant);
+        release_snapshot(job->snapshot);
+        job->snapshot = NULL;
+        return status;
+    }
+    job->running = 1;
+
+    return 0;
+}
+
+void *run_save_job(void *arg)
+{
+    save_job_t *job = arg;
+    job->status = write_snapshot(job->snapshot, job->filename, job->harness, job->variant);
+    release_snapshot(job->snapshot);
+    job->snapshot = NULL;
+    atomic_store(&job->done, 1);
+
+    return NULL;
+}
+
+// Reaps a finished save without waiting for one that is still running
+void poll_save_job(program_state_t *state)
+{
+    if (state->save_job.running && atomic_load(&state->save_job.done)) {
+        (void)finish_save_job(state);
+    }
+}
+
+// Waits for the save in progress, if any, and returns its status
+int finish_save_job(program_state_t *state)
+{
+    save_job_t *job = &state->save_job;
+    if (!job->running) {
+        return 0;
+    }
+    pthread_join(job->thread, NULL);
+    job->running = 0;
+    if (job->status != 0) {
+        fprintf(stderr, "Error saving %s\n", job->filename);
+    }
+
+    return job->status;
+}
+
+// Brings back a deleted wire that has not been compacted away. Returns its
+// row, or -1 if it is gone.
+int revive_wire(wire_table_t *t, handle_t h)
+{
+    if (h.generation == 0 || h.index >= (uint32_t)t->n_wires || !WIRE_IS_DEAD(t, h.index) || t->generation[h.index] != h.generation) {
+        return -1;
+    }
+    BITSET_CLEAR(t->dead, h.index);
+    MARK_WIRE_CHANGED(t, h.index);
+    t->n_dead--;
+    t->version++;
+
+    return (int)h.index;
+}
+
+// Called at the start of each editing command
+void begin_edit_step(program_state_t *state)
+{
+    // Edits change the model the prefetch job reads
+    finish_prefetch_job(state);
+    state->history.step++;
+}
+
+int push_edit(edit_stack_t *s, const edit_t *e)
+{
+    if (s->n_edits == s->max_edits) {
+        int max_edits = s->max_edits == 0 ? 64 : s->max_edits * 2;
+        void *mem = realloc(s->edits, sizeof *s->edits * max_edits);
+        if (mem == NULL) {
+            fprintf(stderr, "Error allocating memory\n");
+            return 1;
+        }
+        s->edits = mem;
+        s->max_edits = max_edits;
+    }
+    s->edits[s->n_edits++] = *e;
+
+    return 0;
+}
+
+// A new edit makes the redo stack meaningless
+void record_edit(program_state_t *state, const edit_t *e)
+{
+    edit_t edit = *e;
+    edit.step = state->history.step;
+    (void)push_edit(&state->history.undo, &edit);
+    state->history.redo.n_edits = 0;
+}
+
+// Call after adding a wire or before deleting it
+void record_wire_presence(program_state_t *state, harness_description_t *hd, edit_kind_t kind, int wire)
+{
+    edit_t e = {.kind = kind, .harness = (int)(hd - state->harness_descriptions)};
+    e.wire = wire_handle(&hd->wires, wire);
+    e.description = get_wire(&hd->wires, wire);
+    record_edit(state, &e);
+}
+
+void record_wire_change(program_state_t *state, harness_description_t *hd, edit_kind_t kind, int wire, edit_value_t before, edit_value_t after)
+{
+    edit_t e = {.kind = kind, .harness = (int)(hd - state->harness_descriptions)};
+    e.wire = wire_handle(&hd->wires, wire);
+    e.change.before = before;
+    e.change.after = after;
+    record_edit(state, &e);
+}
+
+// Reverts an edit (undo != 0) or makes it again. Returns 1 if what it refers
+// to no longer exists.
+int apply_edit(program_state_t *state, edit_t *e, int undo)
+{
+    if (e->harness < 0 || e->harness >= state->n_harnesses) {
+        return 1;
+    }
+    harness_description_t *hd = &state->harness_descriptions[e->harness];
+    wire_table_t *t = &hd->wires;
+    edit_value_t value = undo ? e->change.before : e->change.after;
+    int row = -1;
+    switch (e->kind) {
+        case EDIT_ADD_WIRE:
+        case EDIT_DELETE_WIRE:
+            if ((e->kind == EDIT_ADD_WIRE) == (undo != 0)) {
+                row = resolve_wire(t, e->wire);
+                if (row < 0) {
+                    return 1;
+                }
+                delete_wire(t, row);
+                deselect_wire(state, e->harness, row);
+            } else {
+                row = revive_wire(t, e->wire);
+                if (row < 0) {
+                    // The row was compacted away. The wire comes back under
+                    // its old generation, and its other edits are pointed at
+                    // the new row.
+                    row = append_wire(t, &e->description, e->wire.generation != 0 ? e->wire.generation : next_generation(state));
+                    if (row < 0) {
+                        return 1;
+                    }
+                    relink_wire_edits(&state->history, e->harness, t->generation[row], row);
+                }
+                e->wire = wire_handle(t, row);
+            }
+            break;
+        case EDIT_WIRE_VARIANTS:
+        case EDIT_WIRE_COLOUR:
+        case EDIT_WIRE_THICKNESS:
+            row = resolve_wire(t, e->wire);
+            if (row < 0) {
+                return 1;
+            }
+            MARK_WIRE_CHANGED(t, row);
+            if (e->kind == EDIT_WIRE_VARIANTS) {
+                t->variants[row] = value.variants;
+                // Variant membership changes the nets
+                t->version++;
+            } else if (e->kind == EDIT_WIRE_COLOUR) {
+                t->colour[row] = value.colour;
+            } else {
+                t->thickness[row] = value.thickness;
+                refresh_wire_bounds(state, hd, row);
+            }
+            break;
+        case EDIT_MIRROR_CONNECTOR:
+            if (e->connector < 0 || e->connector >= hd->n_connector_descriptions) {
+                return 1;
+            }
+            hd->connector_descriptions[e->connector].mirror_lr = !hd->connector_descriptions[e->connector].mirror_lr;
+            mark_connector_changed(hd, e->connector);
+            invalidate_connector_layout(state, e->harness, e->connector);
+            break;
+        case EDIT_MOVE_CONNECTOR:
+            if (e->connector < 0 || e->connector >= hd->n_connector_descriptions) {
+                return 1;
+            }
+            hd->connector_descriptions[e->connector].placed = value.position.placed;
+            hd->connector_descriptions[e->connector].x = value.position.x;
+            hd->connector_descriptions[e->connector].y = value.position.y;
+            mark_connector_changed(hd, e->connector);
+            if (state->harnesses != NULL) {
+                // Place everything again; the connector may rejoin a column
+                state->harnesses[e->harness].layout_variants = 0;
+            }
+            break;
+        default:
+            return 1;
+    }
+    mark_harness_edited(state, hd);
+
+    return 0;
+}
+
+// Moves the newest step from one stack to the other, applying its edits.
+// Shows the harness that was edited.
+int replay_edit_step(program_state_t *state, edit_stack_t *from, edit_stack_t *to, int undo)
+{
+    // Edits can be in any harness
+    finish_prefetch_job(state);
+    if (from->n_edits == 0) {
+        return 0;
+    }
+    uint32_t step = from->edits[from->n_edits - 1].step;
+    int harness = from->edits[from->n_edits - 1].harness;
+    int n = 0;
+    int first = 0;
+    edit_t *e = NULL;
+    // Undoing pushes a step's edits onto the redo stack in reverse, so redo
+    // walking it back to front replays them in their original order
+    while (from->n_edits > 0 && from->edits[from->n_edits - 1].step == step) {
+        e = &from->edits[from->n_edits - 1];
+        // A run of wire additions or deletions commutes, so it is applied
+        // front to back; wires that have to be appended again then keep
+        // their order
+        first = from->n_edits - 1;
+        if (e->kind == EDIT_ADD_WIRE || e->kind == EDIT_DELETE_WIRE) {
+            while (first > 0 && from->edits[first - 1].step == step && from->edits[first - 1].kind == e->kind) {
+                first--;
+            }
+        }
+        for (int i = first; i < from->n_edits; ++i) {
+            if (apply_edit(state, &from->edits[i], undo) != 0) {
+                fprintf(stderr, "Unable to %s an edit\n", undo ? "undo" : "redo");
+            }
+        }
+        for (int i = from->n_edits - 1; i >= first; --i) {
+            (void)push_edit(to, &from->edits[i]);
+            n++;
+        }
+        from->n_edits = first;
+    }
+    if (harness != state->harness_index && harness >= 0 && harness < state->n_harnesses) {
+        state->harness_index = harness;
+        state->variant_index = -1;
+    }
+
+    return n;
+}
+
+int undo_edit_step(program_state_t *state)
+{
+    return replay_edit_step(state, &state->history.undo, &state->history.redo, 1);
+}
+
+int redo_edit_step(program_state_t *state)
+{
+    return replay_edit_step(state, &state->history.redo, &state->history.undo, 0);
+}
+
+// Wires whose rows were dropped keep their generation, so that their edits
+// can be found again if undo or redo brings them back; see apply_edit()
+void remap_edit_history(edit_history_t *history, int harness, const int *remap)
+{
+    edit_stack_t *stacks[] = {&history->undo, &history->redo};
+    edit_t *e = NULL;
+    for (int s = 0; s < 2; ++s) {
+        for (int i = 0; i < stacks[s]->n_edits; ++i) {
+            e = &stacks[s]->edits[i];
+            if (e->harness != harness || e->kind == EDIT_MIRROR_CONNECTOR || e->wire.generation == 0 || e->wire.index == COMPACTED_WIRE) {
+                continue;
+            }
+            if (remap[e->wire.index] < 0) {
+                e->wire.index = COMPACTED_WIRE;
+            } else {
+                e->wire.index = (uint32_t)remap[e->wire.index];
+            }
+        }
+    }
+}
+
+void free_edit_history(edit_history_t *history)
+{
+    free(history->undo.edits);
+    free(history->redo.edits);
+    memset(history, 0, sizeof *history);
+}
+
+// Sizes the view state for the largest harness, so that switching harnesses
+// mid-frame stays in bounds, and clears it for the current one. Allocates
+// only when the wiring has grown.
+int prepare_view_state(program_state_t *state)
+{
+    int max_pins = 0;
+    int max_wires = 0;
+    harness_description_t *hd = NULL;
+    for (int i = 0; i < state->n_harnesses; ++i) {
+        hd = &state->harness_descriptions[i];
+        if (hd->n_pins > max_pins) {
+            max_pins = hd->n_pins;
+        }
+        if (hd->wires.n_wires > max_wires) {
+            max_wires = hd->wires.n_wires;
+        }
+    }
+    if (reserve_view_state(&state->view, max_pins, max_wires) != 0) {
+        return 1;
+    }
+    if (state->harness_index >= 0 && state->harness_index < state->n_harnesses) {
+        hd = &state->harness_descriptions[state->harness_index];
+        clear_view_state(&state->view, hd->n_pins, hd->wires.n_wires);
+    }
+
+    return 0;
+}
+
+// Marks every measured size as stale, e.g. after the fonts change
+void invalidate_layout(program_state_t *state)
+{
+    if (state->harnesses == NULL) {
+        return;
+    }
+    finish_prefetch_job(state);
+    harness_t *h = NULL;
+    for (int i = 0; i < state->n_harnesses; ++i) {
+        h = &state->harnesses[i];
+        for (int j = 0; j < h->n_connectors; ++j) {
+            h->connectors[j].needs_layout = 1;
+        }
+        h->needs_layout = 1;
+    }
+}
+
+void invalidate_connector_layout(program_state_t *state, int harness, int connector)
+{
+    if (state->harnesses == NULL || harness < 0 || harness >= state->n_harnesses) {
+        return;
+    }
+    harness_t *h = &state->harnesses[harness];
+    if (connector < 0 || connector >= h->n_connectors) {
+        return;
+    }
+    h->connectors[connector].needs_layout = 1;
+    h->needs_layout = 1;
+}
+
+// Measures whatever has been invalidated since the harness was last drawn
+void update_harness_layout(program_state_t *state, harness_t *h)
+{
+    connector_t *c = NULL;
+    // Connectors showing only wired pins change size with the wiring
+    if (h->rows_wire_version != h->description->wires.version) {
+        h->rows_wire_version = h->description->wires.version;
+        for (int i = 0; i < h->n_connectors; ++i) {
+            c = &h->connectors[i];
+            if (c->pin_view == PIN_VIEW_WIRED) {
+                c->needs_layout = 1;
+                h->needs_layout = 1;
+            }
+        }
+    }
+    if (!h->needs_layout) {
+        return;
+    }
+    for (int i = 0; i < h->n_connectors; ++i) {
+        c = &h->connectors[i];
+        if (c->needs_layout) {
+            create_connector(state, h, c);
+        }
+    }
+    harness_description_t *hd = h->description;
+    Font font = state->fonts[CONNECTOR_FONT];
+    char label[LINE_MAX_LEN] = {0};
+    for (int s = 0; s < hd->n_splices; ++s) {
+        format_splice_label(state, hd, s, label, LINE_MAX_LEN);
+        h->splices[s].label_width = text_width(label, font, state->font_sizes[CONNECTOR_FONT], FONT_SPACING);
+    }
+    h->needs_layout = 0;
+    // Sizes may have changed, so place the connectors again
+    h->layout_variants = 0;
+}
+
+int format_splice_label(program_state_t *state, const harness_description_t *hd, int splice, char *buf, size_t len)
+{
+    if (hd->splices[splice].name != 0) {
+        return snprintf(buf, len, "%s", string_from_id(&state->strings, hd->splices[splice].name));
+    }
+
+    return snprintf(buf, len, "S%d", splice + 1);
+}
+
+// Stacks the connectors into columns in world coordinates, from the origin,
+// in the order given by h->order. Connectors that have been dragged stay
+// where they were put. Only redone when sizes, the order, the
+// variant selection or the column count change, or when wires change while
+// connector sides depend on them.
+void place_connectors(program_state_t *state, harness_t *h, variant_mask_t variants)
+{
+    uint32_t wire_version = h->description->wires.version;
+    if (h->layout_variants == variants && h->layout_columns == state->n_columns && (state->n_columns == 0 || h->layout_wire_version == wire_version)) {
+        return;
+    }
+    int n_columns = 2;
+    if (state->n_columns == 0) {
+        assign_columns_by_side(h);
+    } else {
+        n_columns = state->n_columns;
+        if (h->ordered_columns != n_columns || h->ordered_variants != variants) {
+            h->ordered_columns = 0;
+            assign_balanced_columns(h, variants, n_columns);
+        }
+        if (choose_connector_sides(h, variants, n_columns) != 0) {
+            return;
+        }
+    }
+
+    // Each column is as wide as its widest connector
+    connector_t *c = NULL;
+    float widths[MAX_COLUMNS] = {0};
+    float x[MAX_COLUMNS] = {0};
+    float y[MAX_COLUMNS] = {0};
+    int n_used = 1;
+    for (int i = 0; i < h->n_connectors; ++i) {
+        c = &h->connectors[i];
+        if (!(c->description->variants & variants) || c->description->placed) {
+            continue;
+        }
+        if (c->outline.width > widths[c->column]) {
+            widths[c->column] = c->outline.width;
+        }
+        if (c->column + 1 > n_used) {
+            n_used = c->column + 1;
+        }
+    }
+    for (int k = 1; k < n_columns; ++k) {
+        x[k] = x[k - 1] + widths[k - 1] + (float)CONNECTOR_SPACING_X;
+    }
+    for (int i = 0; i < h->n_connectors; ++i) {
+        c = &h->connectors[h->order[i]];
+        if (!(c->description->variants & variants)) {
+            continue;
+        }
+        if (c->description->placed) {
+            c->outline.x = c->description->x;
+            c->outline.y = c->description->y;
+        } else {
+            c->outline.x = x[c->column];
+            c->outline.y = y[c->column];
+            y[c->column] += c->outline.height + CONNECTOR_SPACING_Y;
+        }
+        if (c->facing_left && !c->left_rows_measured) {
+            measure_left_pin_rows(state, h, c);
+        }
+    }
+    // Splices go between the columns in use, or right of a single column
+    h->n_gaps = n_used > 1 ? n_used - 1 : 1;
+    for (int k = 0; k < h->n_gaps; ++k) {
+        h->gaps[k] = x[k] + widths[k];
+    }
+    h->layout_variants = variants;
+    h->layout_columns = state->n_columns;
+    h->layout_wire_version = wire_version;
+    h->geometry_stale = 1;
+}
+
+// The world origin is shown at draw_offset, scaled by the zoom level
+void update_camera(program_state_t *state)
+{
+    state->camera.offset = state->draw_offset;
+    state->camera.target = (Vector2){0, 0};
+    state->camera.rotation = 0;
+    state->camera.zoom = state->zoom_level;
+}
+
+// Reduces wire crossings by reordering the connectors within each column,
+// using the barycentric heuristic. Each pass moves the connectors of one
+// column to the mean height of whatever their wires lead to, then the next
+// column is done against the result. places gives the column each connector
+// is drawn in and the side it faces; placed connectors keep their slots and
+// their wires are not counted. Splices sit in the gap between the columns
+// their wires lead to, at the mean height of their wires. The order with the
+// fewest crossings seen is kept. Heights are counted in pin rows, so no fonts
+// are needed and this can run on any thread. order holds the current order
+// on entry and the new one on return. Pins keep their physical order.
+int order_connectors(const harness_snapshot_t *hs, variant_mask_t variants, const order_place_t *places, int *order)
+{
+    const harness_description_t *hd = &hs->description;
+    int n = hd->n_connector_descriptions;
+    const wire_table_t *wires = &hd->wires;
+    if (n < 2 || wires->n_wires == 0) {
+        return 0;
+    }
+    int n_vertices = n + hd->n_splices;
+
+    int *live = malloc(sizeof *live * wires->n_wires);
+    int *layers = malloc(sizeof *layers * n_vertices);
+    float *top = calloc(n, sizeof *top);
+    float *splice_row = calloc(hd->n_splices + 1, sizeof *splice_row);
+    float *sum = calloc(n_vertices, sizeof *sum);
+    int *count = calloc(n_vertices, sizeof *count);
+    int *best = malloc(sizeof *best * n);
+    order_key_t *keys = malloc(sizeof *keys * n);
+    order_edge_t *edges = malloc(sizeof *edges * wires->n_wires);
+    float *scratch = malloc(sizeof *scratch * 2 * wires->n_wires);
+    int status = 0;
+    if (live == NULL || layers == NULL || top == NULL || splice_row == NULL || sum == NULL || count == NULL || best == NULL || keys == NULL || edges == NULL || scratch == NULL) {
+        fprintf(stderr, "Error allocating memory\n");
+        status = 1;
+        goto cleanup;
+    }
+    int n_used = order_layers(hs, variants, places, layers, sum, count);
+
+    // Only wires between two valid ends in the selected variants count
+    int n_live = 0;
+    for (int i = 0; i < wires->n_wires; ++i) {
+        if (SNAPSHOT_WIRE_IS_DEAD(hs, i) || !snapshot_wire_in_variants(hs, i, variants)) {
+            continue;
+        }
+        if (order_endpoint_layer(hs, layers, SNAPSHOT_WIRE(hs, end1, i)) < 0 || order_endpoint_layer(hs, layers, SNAPSHOT_WIRE(hs, end2, i)) < 0) {
+            continue;
+        }
+        live[n_live++] = i;
+    }
+
+    place_order_rows(hs, variants, places, live, n_live, order, top, splice_row, count);
+    long best_crossings = count_crossings(hs, layers, live, n_live, top, splice_row, edges, scratch);
+    long crossings = 0;
+    memcpy(best, order, sizeof *best * n);
+    int stale = 0;
+    // Columns are done one per pass, across and back again
+    int period = n_used > 1 ? 2 * (n_used - 1) : 1;
+    int column = 0;
+    for (int sweep = 0; sweep < ORDER_SWEEPS && best_crossings > 0 && stale < ORDER_PATIENCE; ++sweep) {
+        column = sweep % period < n_used ? sweep % period : period - sweep % period;
+        order_column(hs, layers, live, n_live, 2 * column, order, top, splice_row, sum, count, keys);
+        place_order_rows(hs, variants, places, live, n_live, order, top, splice_row, count);
+        crossings = count_crossings(hs, layers, live, n_live, top, splice_row, edges, scratch);
+        if (crossings < best_crossings) {
+            best_crossings = crossings;
+            memcpy(best, order, sizeof *best * n);
+            stale = 0;
+        } else {
+            stale++;
+        }
+    }
+    memcpy(order, best, sizeof *order * n);
+
+cleanup:
+    free(live);
+    free(layers);
+    free(top);
+    free(splice_row);
+    free(sum);
+    free(count);
+    free(best);
+    free(keys);
+    free(edges);
+    free(scratch);
+
+    return status;
+}
+
+// Row of a wire end: a connector's pin row, or a splice's height
+float order_endpoint_row(const float *top, const float *splice_row, endpoint_t e)
+{
+    if (ENDPOINT_IS_SPLICE(e)) {
+        return splice_row[ENDPOINT_PIN(e) - 1];
+    }
+
+    // Pin rows follow the name and type rows, as in draw_harness()
+    return top[ENDPOINT_CONNECTOR(e) - 1] + 1.5f + (float)ENDPOINT_PIN(e);
+}
+
+// Layer of a wire end, from order_layers(), or -1 for an end that does not
+// exist or is not ordered
+int order_endpoint_layer(const harness_snapshot_t *hs, const int *layers, endpoint_t e)
+{
+    const harness_description_t *hd = &hs->description;
+    if (ENDPOINT_IS_SPLICE(e)) {
+        int s = ENDPOINT_PIN(e) - 1;
+        return s >= 0 && s < hd->n_splices ? layers[hd->n_connector_descriptions + s] : -1;
+    }
+    int c = ENDPOINT_CONNECTOR(e) - 1;
+    if (c < 0 || c >= hd->n_connector_descriptions) {
+        return -1;
+    }
+
+    return layers[c];
+}
+
+// Sorts the connectors of one column, at the given layer, by the mean row of the
+// other ends of their wires, less the row of their own pin, which is where
+// the connector's top would have to be for its wires to run level. Wires
+// within the column are ignored, and connectors with no other wires keep their
+// current row. Ties keep the current order.
+void order_column(const harness_snapshot_t *hs, const int *layers, const int *live, int n_live, int layer, int *order, float *top, const float *splice_row, float *sum, int *count, order_key_t *keys)
+{
+    const harness_description_t *hd = &hs->description;
+    int n = hd->n_connector_descriptions;
+    memset(sum, 0, sizeof *sum * n);
+    memset(count, 0, sizeof *count * n);
+    endpoint_t ends[2] = {0};
+    int c = 0;
+    for (int i = 0; i < n_live; ++i) {
+        ends[0] = SNAPSHOT_WIRE(hs, end1, live[i]);
+        ends[1] = SNAPSHOT_WIRE(hs, end2, live[i]);
+        for (int k = 0; k < 2; ++k) {
+            if (order_endpoint_layer(hs, layers, ends[k]) != layer || order_endpoint_layer(hs, layers, ends[1 - k]) == layer) {
+                continue;
+            }
+            c = ENDPOINT_CONNECTOR(ends[k]) - 1;
+            sum[c] += order_endpoint_row(top, splice_row, ends[1 - k]) - (order_endpoint_row(top, splice_row, ends[k]) - top[c]);
+            count[c]++;
+        }
+    }
+
+    int n_keys = 0;
+    for (int i = 0; i < n; ++i) {
+        c = order[i];
+        if (layers[c] != layer) {
+            continue;
+        }
+        keys[n_keys].key = count[c] > 0 ? sum[c] / (float)count[c] : top[c];
+        keys[n_keys].rank = n_keys;
+        keys[n_keys].connector = c;
+        n_keys++;
+    }
+    qsort(keys, n_keys, sizeof *keys, compare_order_keys);
+
+    // The column's connectors go back into the slots they came from
+    int k = 0;
+    for (int i = 0; i < n; ++i) {
+        c = order[i];
+        if (layers[c] != layer) {
+            continue;
+        }
+        order[i] = keys[k++].connector;
+    }
+}
+
+// Stacks the connectors in rows as place_connectors() does, then puts each
+// splice at the mean row of the pins wired to it
+void place_order_rows(const harness_snapshot_t *hs, variant_mask_t variants, const order_place_t *places, const int *live, int n_live, const int *order, float *top, float *splice_row, int *count)
+{
+    const harness_description_t *hd = &hs->description;
+    float next[MAX_COLUMNS] = {0};
+    const connector_description_t *cd = NULL;
+    const order_place_t *p = NULL;
+    for (int i = 0; i < hd->n_connector_descriptions; ++i) {
+        cd = SNAPSHOT_CONNECTOR(hs, order[i]);
+        p = &places[order[i]];
+        top[order[i]] = next[p->column];
+        if ((cd->variants & variants) && !p->placed) {
+            // Name and type rows, the pins and a row of spacing
+            next[p->column] += (float)cd->n_pins + 3.0f;
+        }
+    }
+
+    if (hd->n_splices == 0) {
+        return;
+    }
+    memset(splice_row, 0, sizeof *splice_row * hd->n_splices);
+    memset(count, 0, sizeof *count * hd->n_splices);
+    endpoint_t ends[2] = {0};
+    int s = 0;
+    for (int i = 0; i < n_live; ++i) {
+        ends[0] = SNAPSHOT_WIRE(hs, end1, live[i]);
+        ends[1] = SNAPSHOT_WIRE(hs, end2, live[i]);
+        for (int k = 0; k < 2; ++k) {
+            if (!ENDPOINT_IS_SPLICE(ends[k]) || ENDPOINT_IS_SPLICE(ends[1 - k])) {
+                continue;
+            }
+            s = ENDPOINT_PIN(ends[k]) - 1;
+            splice_row[s] += order_endpoint_row(top, splice_row, ends[1 - k]);
+            count[s]++;
+        }
+    }
+    for (s = 0; s < hd->n_splices; ++s) {
+        if (count[s] > 0) {
+            splice_row[s] /= (float)count[s];
+        }
+    }
+}
+
+// Counts pairs of wires that cross between the same two layers, by sorting the
+// wires on one end and counting inversions on the other: O(wires log wires)
+long count_crossings(const harness_snapshot_t *hs, const int *layers, const int *live, int n_live, const float *top, const float *splice_row, order_edge_t *edges, float *scratch)
+{
+    int n_edges = 0;
+    endpoint_t a = 0;
+    endpoint_t b = 0;
+    int layer_a = 0;
+    int layer_b = 0;
+    for (int i = 0; i < n_live; ++i) {
+        a = SNAPSHOT_WIRE(hs, end1, live[i]);
+        b = SNAPSHOT_WIRE(hs, end2, live[i]);
+        layer_a = order_endpoint_layer(hs, layers, a);
+        layer_b = order_endpoint_layer(hs, layers, b);
+        if (layer_a == layer_b) {
+            continue;
+        }
+        if (layer_a > layer_b) {
+            endpoint_t e = a;
+            a = b;
+            b = e;
+            int l = layer_a;
+            layer_a = layer_b;
+            layer_b = l;
+        }
+        edges[n_edges].layers = layer_a * 2 * MAX_COLUMNS + layer_b;
+        edges[n_edges].y1 = order_endpoint_row(top, splice_row, a);
+        edges[n_edges].y2 = order_endpoint_row(top, splice_row, b);
+        n_edges++;
+    }
+    qsort(edges, n_edges, sizeof *edges, compare_order_edges);
+
+    long crossings = 0;
+    float *y = scratch;
+    int start = 0;
+    int end = 0;
+    while (start < n_edges) {
+        end = start;
+        while (end < n_edges && edges[end].layers == edges[start].layers) {
+            y[end - start] = edges[end].y2;
+            end++;
+        }
+        crossings += count_inversions(y, scratch + n_edges, end - start);
+        start = end;
+    }
+
+    return crossings;
+}
+
+// Number of pairs i < j with y[i] > y[j], by bottom-up merge sort. Sorts y.
+long count_inversions(float *y, float *scratch, int n)
+{
+    long inversions = 0;
+    float *src = y;
+    float *dst = scratch;
+    float *swap = NULL;
+    int mid = 0;
+    int hi = 0;
+    int i = 0;
+    int j = 0;
+    int k = 0;
+    for (int width = 1; width < n; width *= 2) {
+        for (int lo = 0; lo < n; lo += 2 * width) {
+            mid = lo + width < n ? lo + width : n;
+            hi = lo + 2 * width < n ? lo + 2 * width : n;
+            i = lo;
+            j = mid;
+            k = lo;
+            while (i < mid && j < hi) {
+                if (src[j] < src[i]) {
+                    inversions += mid - i;
+                    dst[k++] = src[j++];
+                } else {
+                    dst[k++] = src[i++];
+                }
+            }
+            while (i < mid) {
+                dst[k++] = src[i++];
+            }
+            while (j < hi) {
+                dst[k++] = src[j++];
+            }
+        }
+        swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != y) {
+        memcpy(y, src, sizeof *y * n);
+    }
+
+    return inversions;
+}
+
+int compare_order_edges(const void *a, const void *b)
+{
+    const order_edge_t *ea = a;
+    const order_edge_t *eb = b;
+    if (ea->layers != eb->layers) {
+        return ea->layers < eb->layers ? -1 : 1;
+    }
+    if (ea->y1 != eb->y1) {
+        return ea->y1 < eb->y1 ? -1 : 1;
+    }
+    if (ea->y2 != eb->y2) {
+        return ea->y2 < eb->y2 ? -1 : 1;
+    }
+
+    return 0;
+}
+
+int compare_order_keys(const void *a, const void *b)
+{
+    const order_key_t *ka = a;
+    const order_key_t *kb = b;
+    if (ka->key != kb->key) {
+        return ka->key < kb->key ? -1 : 1;
+    }
+
+    return ka->rank - kb->rank;
+}
+
+// Starts reordering the current harness's connectors in the background, for
+// the selected variants. A job already running is finished first and its
+// result dropped.
+int start_order_job(program_state_t *state)
+{
+    if (state->harnesses == NULL || state->harness_index < 0 || state->harness_index >= state->n_harnesses) {
+        return 0;
+    }
+    finish_order_job(state);
+
+    order_job_t *job = &state->order_job;
+    harness_t *h = &state->harnesses[state->harness_index];
+    variant_mask_t variants = selected_variants(state, h->description);
+    // Order within the columns as they are drawn now
+    update_harness_layout(state, h);
+    place_connectors(state, h, variants);
+    job->order = malloc(sizeof *job->order * (h->n_connectors > 0 ? h->n_connectors : 1));
+    job->places = malloc(sizeof *job->places * (h->n_connectors > 0 ? h->n_connectors : 1));
+    if (job->order == NULL || job->places == NULL) {
+        fprintf(stderr, "Error allocating memory\n");
+        free(job->order);
+        job->order = NULL;
+        free(job->places);
+        job->places = NULL;
+        return 1;
+    }
+    job->snapshot = acquire_snapshot(state);
+    if (job->snapshot == NULL) {
+        free(job->order);
+        job->order = NULL;
+        free(job->places);
+        job->places = NULL;
+        return 1;
+    }
+    memcpy(job->order, h->order, sizeof *job->order * h->n_connectors);
+    connector_t *c = NULL;
+    for (int i = 0; i < h->n_connectors; ++i) {
+        c = &h->connectors[i];
+        job->places[i].column = c->column;
+        job->places[i].facing_left = c->facing_left;
+        job->places[i].placed = c->description->placed;
+    }
+    job->n_columns = state->n_columns;
+    job->n_connectors = h->n_connectors;
+    job->harness = state->harness_index;
+    job->variants = variants;
+    job->status = 0;
+    atomic_store(&job->done, 0);
+    if (pthread_create(&job->thread, NULL, run_order_job, job) != 0) {
+        // No thread to spare; order right here, for the next poll to apply
+        (void)run_order_job(job);
+        return 0;
+    }
+    job->running = 1;
+
+    return 0;
+}
+
+void *run_order_job(void *arg)
+{
+    order_job_t *job = arg;
+    job->status = order_connectors(job->snapshot->harnesses[job->harness], job->variants, job->places, job->order);
+    atomic_store(&job->done, 1);
+
+    return NULL;
+}
+
+// Applies a finished ordering to its harness, if the harness is still there
+void poll_order_job(program_state_t *state)
+{
+    order_job_t *job = &state->order_job;
+    if (job->order == NULL || !atomic_load(&job->done)) {
+        return;
+    }
+    int *order = job->order;
+    order_place_t *places = job->places;
+    int harness = job->harness;
+    int n_connectors = job->n_connectors;
+    int n_columns = job->n_columns;
+    variant_mask_t variants = job->variants;
+    int status = job->status;
+    job->order = NULL;
+    job->places = NULL;
+    finish_order_job(state);
+    if (status == 0 && state->harnesses != NULL && harness < state->n_harnesses && state->harnesses[harness].n_connectors == n_connectors) {
+        // The harness may have been switched away from and be being prefetched
+        finish_prefetch_job(state);
+        harness_t *h = &state->harnesses[harness];
+        memcpy(h->order, order, sizeof *h->order * n_connectors);
+        // Balancing the new order could move connectors to other columns, so
+        // keep them in the columns they were ordered in
+        if (n_columns > 0 && n_columns == state->n_columns) {
+            for (int i = 0; i < n_connectors; ++i) {
+                h->connectors[i].column = places[i].column;
+            }
+            h->ordered_columns = n_columns;
+            h->ordered_variants = variants;
+        }
+        // Place the connectors again on the next frame
+        h->layout_variants = 0;
+    }
+    free(order);
+    free(places);
+}
+
+// Waits for the ordering in progress, if any, and drops its result
+void finish_order_job(program_state_t *state)
+{
+    order_job_t *job = &state->order_job;
+    if (job->running) {
+        pthread_join(job->thread, NULL);
+        job->running = 0;
+    }
+    release_snapshot(job->snapshot);
+    job->snapshot = NULL;
+    free(job->order);
+    job->order = NULL;
+    free(job->places);
+    job->places = NULL;
+}
+
+// Non-mirrored connectors on the left facing right, mirrored ones on the
+// right facing left
+void assign_columns_by_side(harness_t *h)
+{
+    connector_t *c = NULL;
+    for (int i = 0; i < h->n_connectors; ++i) {
+        c = &h->connectors[i];
+        c->column = c->description->mirror_lr ? 1 : 0;
+        c->facing_left = c->description->mirror_lr ? 1 : 0;
+    }
+}
+
+// Splits the connectors, in order, into n_columns runs of about equal height
+void assign_balanced_columns(harness_t *h, variant_mask_t variants, int n_columns)
+{
+    connector_t *c = NULL;
+    float total = 0.0;
+    for (int i = 0; i < h->n_connectors; ++i) {
+        c = &h->connectors[i];
+        if ((c->description->variants & variants) && !c->description->placed) {
+            total += c->outline.height + CONNECTOR_SPACING_Y;
+        }
+    }
+    float target = total / (float)n_columns;
+    float y = 0.0;
+    int column = 0;
+    int n_in_column = 0;
+    for (int i = 0; i < h->n_connectors; ++i) {
+        c = &h->connectors[h->order[i]];
+        c->column = column;
+        if (!(c->description->variants & variants) || c->description->placed) {
+            continue;
+        }
+        // A connector starts the next column if its middle is past this
+        // column's share. Columns are never left empty.
+        if (column < n_columns - 1 && n_in_column > 0 && y + (c->outline.height + CONNECTOR_SPACING_Y) / 2 > target * (float)(column + 1)) {
+            column++;
+            n_in_column = 0;
+        }
+        c->column = column;
+        n_in_column++;
+        y += c->outline.height + CONNECTOR_SPACING_Y;
+    }
+}
+
+// Turns each connector to face the side most of its wires go to. Connectors
+// with no wires to other columns face the middle of the harness.
+int choose_connector_sides(harness_t *h, variant_mask_t variants, int n_columns)
+{
+    int *votes = calloc(h->n_connectors > 0 ? h->n_connectors : 1, sizeof *votes);
+    if (votes == NULL) {
+        fprintf(stderr, "Error allocating memory\n");
+        return 1;
+    }
+    harness_description_t *hd = h->description;
+    wire_table_t *wires = &hd->wires;
+    int a = 0;
+    int b = 0;
+    for (int i = 0; i < wires->n_wires; ++i) {
+        if (WIRE_IS_DEAD(wires, i) || !wire_in_variants(hd, i, variants)) {
+            continue;
+        }
+        a = ENDPOINT_CONNECTOR(wires->end1[i]) - 1;
+        b = ENDPOINT_CONNECTOR(wires->end2[i]) - 1;
+        if (a < 0 || a >= h->n_connectors || b < 0 || b >= h->n_connectors) {
+            continue;
+        }
+        if (h->connectors[a].column < h->connectors[b].column) {
+            votes[a]++;
+            votes[b]--;
+        } else if (h->connectors[a].column > h->connectors[b].column) {
+            votes[a]--;
+            votes[b]++;
+        }
+    }
+    connector_t *c = NULL;
+    for (int i = 0; i < h->n_connectors; ++i) {
+        c = &h->connectors[i];
+        if (votes[i] != 0) {
+            c->facing_left = votes[i] < 0;
+        } else {
+            c->facing_left = n_columns > 1 && 2 * c->column >= n_columns;
+        }
+    }
+    free(votes);
+
+    return 0;
+}
+
+// Left-aligned pin rows are as long as their pin name, so each one is measured
+// for hit-testing. Right-aligned rows all use pin_row_width.
+void measure_left_pin_rows(program_state_t *state, harness_t *h, connector_t *c)
+{
+    connector_description_t *cd = c->description;
+    Font font = state->fonts[c->font];
+    float font_size = state->font_sizes[c->font];
+    char pin_row[LINE_MAX_LEN] = {0};
+    for (int i = 0; i < cd->n_pins; ++i) {
+        snprintf(pin_row, LINE_MAX_LEN, "%3d %s", cd->pins[i].number, string_from_id(&state->strings, cd->pins[i].name));
+        h->pin_widths[cd->first_pin + i] = text_width(pin_row, font, font_size, FONT_SPACING);
+    }
+    c->left_rows_measured = 1;
+}
+
+// Finds the cell at (x, y), adding it if create is set. Returns NULL if it is
+// not there or cannot be added.
+grid_cell_t *grid_cell(spatial_grid_t *g, int32_t x, int32_t y, int create)
+{
+    if (g->n_slots == 0 || (create && 2 * (g->n_cells + 1) > g->n_slots)) {
+        if (!create || grow_grid(g) != 0) {
+            return NULL;
+        }
+    }
+    uint32_t mask = (uint32_t)g->n_slots - 1;
+    uint32_t slot = ((uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u) & mask;
+    grid_cell_t *cell = NULL;
+    while (1) {
+        cell = &g->cells[slot];
+        if (!cell->used) {
+            break;
+        }
+        if (cell->x == x && cell->y == y) {
+            return cell;
+        }
+        slot = (slot + 1) & mask;
+    }
+    if (!create) {
+        return NULL;
+    }
+    cell->used = 1;
+    cell->x = x;
+    cell->y = y;
+    g->n_cells++;
+
+    return cell;
+}
+
+// Doubles the hash table, moving the cells and their item lists across
+int grow_grid(spatial_grid_t *g)
+{
+    int n_slots = g->n_slots == 0 ? 64 : g->n_slots * 2;
+    grid_cell_t *cells = calloc(n_slots, sizeof *cells);
+    if (cells == NULL) {
+        fprintf(stderr, "Error allocating memory\n");
+        return 1;
+    }
+    uint32_t mask = (uint32_t)n_slots - 1;
+    uint32_t slot = 0;
+    grid_cell_t *old = NULL;
+    for (int i = 0; i < g->n_slots; ++i) {
+        old = &g->cells[i];
+        if (!old->used) {
+            continue;
+        }
+        slot = ((uint32_t)old->x * 73856093u ^ (uint32_t)old->y * 19349663u) & mask;
+        while (cells[slot].used) {
+            slot = (slot + 1) & mask;
+        }
+        cells[slot] = *old;
+    }
+    free(g->cells);
+    g->cells = cells;
+    g->n_slots = n_slots;
+
+    return 0;
+}
+
+int reserve_grid_items(spatial_grid_t *g, int n_items)
+{
+    if (n_items <= g->max_items) {
+        return 0;
+    }
+    int max_items = g->max_items == 0 ? 256 : g->max_items;
+    while (max_items < n_items) {
+        max_items *= 2;
+    }
+    void *mem = realloc(g->stamps, sizeof *g->stamps * max_items);
+    if (mem == NULL) {
+        fprintf(stderr, "Error allocating memory\n");
+        return 1;
+    }
+    g->stamps = mem;
+    mem = realloc(g->seen, sizeof *g->seen * max_items);
+    if (mem == NULL) {
+        fprintf(stderr, "Error allocating memory\n");
+        return 1;
+    }
+    g->seen = mem;
+    memset(&g->stamps[g->max_items], 0, sizeof *g->stamps * (max_items - g->max_items));
+    memset(&g->seen[g->max_items], 0, sizeof *g->seen * (max_items - g->max_items));
+    g->max_items = max_items;
+
+    return 0;
+}
+
+grid_span_t grid_span_of(Rectangle r)
+{
+    grid_span_t span = {0};
+    span.x0 = (int32_t)floorf(r.x / GRID_CELL_SIZE);
+    span.y0 = (int32_t)floorf(r.y / GRID_CELL_SIZE);
+    span.x1 = (int32_t)floorf((r.x + r.width) / GRID_CELL_SIZE);
+    span.y1 = (int32_t)floorf((r.y + r.height) / GRID_CELL_SIZE);
+
+    return span;
+}
+
+void grid_remove(spatial_grid_t *g, int item)
+{
+    if (item >= 0 && item < g->max_items) {
+        g->stamps[item]++;
+    }
+}
+
+// Drops entries for items that have since been moved or removed
+void prune_grid_cell(spatial_grid_t *g, grid_cell_t *cell)
+{
+    int n = 0;
+    for (int k = 0; k < cell->n_entries; ++k) {
+        if (cell->entries[k].stamp == g->stamps[cell->entries[k].item]) {
+            cell->entries[n++] = cell->entries[k];
+        }
+    }
+    cell->n_entries = n;
+}
+
+// Inserts an item, or moves it if it is already in the grid
+int grid_insert(spatial_grid_t *g, int item, Rectangle r)
+{
+    if (reserve_grid_items(g, item + 1) != 0) {
+        return 1;
+    }
+    grid_remove(g, item);
+    grid_span_t span = grid_span_of(r);
+    grid_cell_t *cell = NULL;
+    void *mem = NULL;
+    for (int32_t y = span.y0; y <= span.y1; ++y) {
+        for (int32_t x = span.x0; x <= span.x1; ++x) {
+            cell = grid_cell(g, x, y, 1);
+            if (cell == NULL) {
+                return 1;
+            }
+            if (cell->n_entries == cell->max_entries) {
+                prune_grid_cell(g, cell);
+            }
+            if (cell->n_entries == cell->max_entries) {
+                int max_entries = cell->max_entries == 0 ? 8 : cell->max_entries * 2;
+                mem = realloc(cell->entries, sizeof *cell->entries * max_entries);
+                if (mem == NULL) {
+                    fprintf(stderr, "Error allocating memory\n");
+                    return 1;
+                }
+                cell->entries = mem;
+                cell->max_entries = max_entries;
+            }
+            cell->entries[cell->n_entries++] = (grid_entry_t){item, g->stamps[item]};
+        }
+    }
+
+    return 0;
+}
+
+// Appends the items in the cells overlapping r to items, each once. Items
+// near r but not in it can be reported too.
+int grid_query(spatial_grid_t *g, Rectangle r, int **items, int *n_items, int *max_items)
+{
+    if (++g->query == 0) {
+        memset(g->seen, 0, sizeof *g->seen * g->max_items);
+        g->query = 1;
+    }
+    grid_span_t span = grid_span_of(r);
+    grid_cell_t *cell = NULL;
+    void *mem = NULL;
+    int item = 0;
+    for (int32_t y = span.y0; y <= span.y1; ++y) {
+        for (int32_t x = span.x0; x <= span.x1; ++x) {
+            cell = grid_cell(g, x, y, 0);
+            if (cell == NULL) {
+                continue;
+            }
+            prune_grid_cell(g, cell);
+            for (int k = 0; k < cell->n_entries; ++k) {
+                item = cell->entries[k].item;
+                if (g->seen[item] == g->query) {
+                    continue;
+                }
+                g->seen[item] = g->query;
+                if (*n_items == *max_items) {
+                    int max = *max_items == 0 ? 256 : *max_items * 2;
+                    mem = realloc(*items, sizeof **items * max);
+                    if (mem == NULL) {
+                        fprintf(stderr, "Error allocating memory\n");
+                        return 1;
+                    }
+                    *items = mem;
+                    *max_items = max;
+                }
+                (*items)[(*n_items)++] = item;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Empties every cell, keeping the memory
+void clear_grid(spatial_grid_t *g)
+{
+    for (int i = 0; i < g->n_slots; ++i) {
+        g->cells[i].n_entries = 0;
+    }
+}
+
+void free_grid(spatial_grid_t *g)
+{
+    for (int i = 0; i < g->n_slots; ++i) {
+        free(g->cells[i].entries);
+    }
+    free(g->cells);
+    free(g->stamps);
+    free(g->seen);
+    memset(g, 0, sizeof *g);
+}
+
+// Recomputes every wire curve, the wires at each connector and the spatial
+// grid after the connectors have been placed again or the wiring has changed.
+// Moving a single connector is handled by move_connector() instead.
+int update_wire_geometry(program_state_t *state, harness_t *h)
+{
+    harness_description_t *hd = h->description;
+    wire_table_t *wires = &hd->wires;
+    if (!h->geometry_stale && h->geometry_wire_version == wires->version && h->geometry_orthogonal == state->orthogonal) {
+        if (!state->orthogonal || !h->tracks_stale) {
+            return 0;
+        }
+        // Wire ends have moved; only the tracks need working out again
+        if (assign_wire_tracks(h) != 0) {
+            return 1;
+        }
+        for (int i = 0; i < wires->n_wires; ++i) {
+            if (!h->curves[i].valid) {
+                continue;
+            }
+            route_wire(state, h, i);
+            if (grid_insert(&h->grid, h->n_connectors + i, h->curves[i].bounds) != 0) {
+                return 1;
+            }
+        }
+        h->tracks_stale = 0;
+        return 0;
+    }
+
+    void *mem = NULL;
+    if (wires->n_wires > h->max_curves) {
+        mem = realloc(h->curves, sizeof *h->curves * wires->n_wires);
+        if (mem == NULL) {
+            fprintf(stderr, "Error allocating memory\n");
+            return 1;
+        }
+        h->curves = mem;
+        h->max_curves = wires->n_wires;
+    }
+
+    for (int i = 0; i < wires->n_wires; ++i) {
+        update_wire_curve(state, h, i);
+    }
+    if (build_csr(h->n_connectors, wires->n_wires, connector_wire_keys, h, h->connector_wire_offsets, &h->connector_wires, &h->max_connector_wires) != 0) {
+        return 1;
+    }
+    if (state->orthogonal) {
+        if (assign_wire_tracks(h) != 0) {
+            return 1;
+        }
+        for (int i = 0; i < wires->n_wires; ++i) {
+            if (h->curves[i].valid) {
+                route_wire(state, h, i);
+            }
+        }
+    }
+    h->tracks_stale = 0;
+
+    clear_grid(&h->grid);
+    if (reserve_grid_items(&h->grid, h->n_connectors + wires->n_wires) != 0) {
+        return 1;
+    }
+    for (int i = 0; i < h->n_connectors; ++i) {
+        if (grid_insert(&h->grid, i, h->connectors[i].outline) != 0) {
+            return 1;
+        }
+    }
+    for (int i = 0; i < wires->n_wires; ++i) {
+        if (h->curves[i].valid && grid_insert(&h->grid, h->n_connectors + i, h->curves[i].bounds) != 0) {
+            return 1;
+        }
+    }
+    h->geometry_wire_version = wires->version;
+    h->geometry_orthogonal = (uint8_t)state->orthogonal;
+    h->geometry_stale = 0;
+
+    return 0;
+}
+
+// Wires leave each connector on the side its pins face. Wires to splices are
+// not cached, since the splices are laid out every frame.
+void update_wire_curve(program_state_t *state, harness_t *h, int wire)
+{
+    wire_table_t *wires = &h->description->wires;
+    wire_curve_t *wc = &h->curves[wire];
+    wc->valid = 0;
+    if (WIRE_IS_DEAD(wires, wire) || ENDPOINT_IS_SPLICE(wires->end1[wire]) || ENDPOINT_IS_SPLICE(wires->end2[wire])) {
+        return;
+    }
+    Vector2 end1 = {0};
+    Vector2 end2 = {0};
+    if (pin_anchor(state, h, wires->end1[wire], &end1) != 0) {
+        fprintf(stderr, "Invalid source connector number for wire %d\n", wire + 1);
+        return;
+    }
+    if (pin_anchor(state, h, wires->end2[wire], &end2) != 0) {
+        fprintf(stderr, "Invalid target connector number for wire %d\n", wire + 1);
+        return;
+    }
+    wc->points[0] = end1;
+    wc->points[3] = end2;
+    wc->valid = 1;
+    route_wire(state, h, wire);
+}
+
+// Fills in the middle of a wire's path from its ends, and its bounds. A
+// routed wire keeps the track it was last given until the tracks are
+// assigned again.
+void route_wire(program_state_t *state, harness_t *h, int wire)
+{
+    wire_table_t *wires = &h->description->wires;
+    wire_curve_t *wc = &h->curves[wire];
+    Vector2 end1 = wc->points[0];
+    Vector2 end2 = wc->points[3];
+    if (state->orthogonal) {
+        wc->points[1] = (Vector2){wc->track_x, end1.y};
+        wc->points[2] = (Vector2){wc->track_x, end2.y};
+    } else {
+        float dx = wires->straight_fraction[wire] * (float)CONNECTOR_SPACING_X;
+        float dx1 = h->connectors[ENDPOINT_CONNECTOR(wires->end1[wire]) - 1].facing_left ? -dx : dx;
+        float dx2 = h->connectors[ENDPOINT_CONNECTOR(wires->end2[wire]) - 1].facing_left ? -dx : dx;
+        wc->points[1] = (Vector2){end1.x + dx1, end1.y};
+        wc->points[2] = (Vector2){end2.x + dx2, end2.y};
+    }
+    set_wire_bounds(h, wire);
+}
+
+// The curve lies within the hull of its control points
+void set_wire_bounds(harness_t *h, int wire)
+{
+    wire_curve_t *wc = &h->curves[wire];
+    float margin = h->description->wires.thickness[wire] / 2.0f + WIRE_BOUNDS_MARGIN;
+    float x0 = wc->points[0].x;
+    float y0 = wc->points[0].y;
+    float x1 = x0;
+    float y1 = y0;
+    for (int k = 1; k < 4; ++k) {
+        x0 = fminf(x0, wc->points[k].x);
+        y0 = fminf(y0, wc->points[k].y);
+        x1 = fmaxf(x1, wc->points[k].x);
+        y1 = fmaxf(y1, wc->points[k].y);
+    }
+    wc->bounds = (Rectangle){x0 - margin, y0 - margin, x1 - x0 + 2 * margin, y1 - y0 + 2 * margin};
+}
+
+// Moves one connector in the view, updating only its own wires and their
+// places in the grid
+void move_connector(program_state_t *state, harness_t *h, int connector, Vector2 position)
+{
+    connector_t *c = &h->connectors[connector];
+    c->outline.x = position.x;
+    c->outline.y = position.y;
+    if (h->geometry_stale) {
+        return;
+    }
+    (void)grid_insert(&h->grid, connector, c->outline);
+    int wire = 0;
+    for (int k = h->connector_wire_offsets[connector]; k < h->connector_wire_offsets[connector + 1]; ++k) {
+        wire = h->connector_wires[k];
+        update_wire_curve(state, h, wire);
+        if (h->curves[wire].valid) {
+            (void)grid_insert(&h->grid, h->n_connectors + wire, h->curves[wire].bounds);
+        } else {
+            grid_remove(&h->grid, h->n_connectors + wire);
+        }
+    }
+}
+
+// Lists the connectors and wires in the part of the world that is on screen
+int find_visible_items(program_state_t *state, harness_t *h)
+{
+    Vector2 top_left = GetScreenToWorld2D((Vector2){0, 0}, state->camera);
+    Vector2 bottom_right = GetScreenToWorld2D((Vector2){GetScreenWidth(), GetScreenHeight()}, state->camera);
+    Rectangle view = {top_left.x, top_left.y, bottom_right.x - top_left.x, bottom_right.y - top_left.y};
+    h->n_visible = 0;
+    if (grid_query(&h->grid, view, &h->visible, &h->n_visible, &h->max_visible) != 0) {
+        return 1;
+    }
+    qsort(h->visible, h->n_visible, sizeof *h->visible, compare_ints);
+
+    return 0;
+}
+
+int compare_ints(const void *a, const void *b)
+{
+    int ia = *(const int *)a;
+    int ib = *(const int *)b;
+
+    return (ia > ib) - (ia < ib);
+}
+
+// Picks up the connector under the pointer, unless a pin is under it, which
+// starts a wire instead
+void start_connector_drag(program_state_t *state)
+{
+    if (state->harnesses == NULL || state->harness_index < 0 || state->harness_index >= state->n_harnesses) {
+        return;
+    }
+    harness_t *h = &state->harnesses[state->harness_index];
+    int i = find_connector_at(state, h, state->mouse_position);
+    if (i < 0) {
+        return;
+    }
+    connector_t *c = &h->connectors[i];
+    view_state_t *view = &state->view;
+    int pin_id = 0;
+    for (int k = 0; k < view->n_hovered_pins; ++k) {
+        pin_id = view->hovered_pins[k];
+        if (pin_id >= c->description->first_pin && pin_id < c->description->first_pin + c->description->n_pins && BITSET_TEST(view->pin_under_pointer, pin_id)) {
+            return;
+        }
+    }
+    state->drag.active = 1;
+    state->drag.harness = state->harness_index;
+    state->drag.connector = i;
+    state->drag.start = (Vector2){c->outline.x, c->outline.y};
+    state->drag.grab = (Vector2){state->mouse_position.x - c->outline.x, state->mouse_position.y - c->outline.y};
+}
+
+void drag_connector(program_state_t *state)
+{
+    connector_drag_t *drag = &state->drag;
+    if (drag->harness != state->harness_index || state->harnesses == NULL) {
+        drag->active = 0;
+        return;
+    }
+    harness_t *h = &state->harnesses[drag->harness];
+    move_connector(state, h, drag->connector, (Vector2){state->mouse_position.x - drag->grab.x, state->mouse_position.y - drag->grab.y});
+}
+
+// Puts the connector down where it was dragged to, as one undoable edit
+void finish_connector_drag(program_state_t *state)
+{
+    connector_drag_t *drag = &state->drag;
+    drag->active = 0;
+    if (drag->harness != state->harness_index || state->harnesses == NULL) {
+        return;
+    }
+    harness_t *h = &state->harnesses[drag->harness];
+    connector_t *c = &h->connectors[drag->connector];
+    if (c->outline.x == drag->start.x && c->outline.y == drag->start.y) {
+        return;
+    }
+    connector_description_t *cd = c->description;
+    edit_t e = {.kind = EDIT_MOVE_CONNECTOR, .harness = drag->harness, .connector = drag->connector};
+    e.change.before.position.placed = cd->placed;
+    e.change.before.position.x = cd->x;
+    e.change.before.position.y = cd->y;
+    e.change.after.position.placed = 1;
+    e.change.after.position.x = c->outline.x;
+    e.change.after.position.y = c->outline.y;
+    begin_edit_step(state);
+    record_edit(state, &e);
+    if (!cd->placed) {
+        // Close up the column it came out of
+        h->layout_variants = 0;
+    }
+    cd->placed = 1;
+    cd->x = c->outline.x;
+    cd->y = c->outline.y;
+    mark_connector_changed(h->description, drag->connector);
+    h->tracks_stale = 1;
+    mark_harness_edited(state, h->description);
+}
+
+// Marks the pins at either end of a wire, whatever its variants
+void update_wired_pins(harness_t *h)
+{
+    harness_description_t *hd = h->description;
+    wire_table_t *wires = &hd->wires;
+    if (h->pin_wired_version == wires->version) {
+        return;
+    }
+    memset(h->pin_wired, 0, sizeof *h->pin_wired * BITSET_WORDS(hd->n_pins > 0 ? hd->n_pins : 1));
+    int v = 0;
+    for (int i = 0; i < wires->n_wires; ++i) {
+        if (WIRE_IS_DEAD(wires, i)) {
+            continue;
+        }
+        if ((v = endpoint_vertex(hd, wires->end1[i])) >= 0 && v < hd->n_pins) {
+            BITSET_SET(h->pin_wired, v);
+        }
+        if ((v = endpoint_vertex(hd, wires->end2[i])) >= 0 && v < hd->n_pins) {
+            BITSET_SET(h->pin_wired, v);
+        }
+    }
+    h->pin_wired_version = wires->version;
+}
+
+// Works out which pin each row shows and which row each pin's wires attach
+// to. A connector has at most as many rows as pins in every view, so the
+// rows fit in the connector's own range of h->row_pins.
+void update_connector_rows(harness_t *h, connector_t *c)
+{
+    connector_description_t *cd = c->description;
+    int *row_pins = &h->row_pins[cd->first_pin];
+    int *pin_rows = &h->pin_rows[cd->first_pin];
+    int n = 0;
+    if (c->pin_view == PIN_VIEW_WIRED) {
+        update_wired_pins(h);
+        for (int k = 0; k < cd->n_pins; ++k) {
+            if (BITSET_TEST(h->pin_wired, cd->first_pin + k)) {
+                pin_rows[k] = n;
+                row_pins[n++] = k;
+            }
+        }
+        if (n < cd->n_pins) {
+            for (int k = 0; k < cd->n_pins; ++k) {
+                if (!BITSET_TEST(h->pin_wired, cd->first_pin + k)) {
+                    pin_rows[k] = n;
+                }
+            }
+            row_pins[n++] = ROW_MORE_BELOW;
+        }
+    } else if (c->pin_view == PIN_VIEW_WINDOW && cd->n_pins > PIN_WINDOW_ROWS + 2) {
+        // The rows for the pins above and below are always there, so that
+        // scrolling does not change the connector's height
+        if (c->first_row > cd->n_pins - PIN_WINDOW_ROWS) {
+            c->first_row = cd->n_pins - PIN_WINDOW_ROWS;
+        }
+        if (c->first_row < 0) {
+            c->first_row = 0;
+        }
+        row_pins[n++] = ROW_MORE_ABOVE;
+        for (int k = 0; k < cd->n_pins; ++k) {
+            if (k < c->first_row) {
+                pin_rows[k] = 0;
+            } else if (k < c->first_row + PIN_WINDOW_ROWS) {
+                pin_rows[k] = n;
+                row_pins[n++] = k;
+            } else {
+                pin_rows[k] = PIN_WINDOW_ROWS + 1;
+            }
+        }
+        row_pins[n++] = ROW_MORE_BELOW;
+    } else {
+        for (int k = 0; k < cd->n_pins; ++k) {
+            pin_rows[k] = k;
+        }
+        n = cd->n_pins;
+    }
+    c->n_rows = n;
+}
+
+// Returns the index of the pin on a row, or ROW_MORE_ABOVE / ROW_MORE_BELOW
+int connector_row_pin(const harness_t *h, const connector_t *c, int row)
+{
+    if (c->n_rows == c->description->n_pins && c->pin_view != PIN_VIEW_WIRED) {
+        return row;
+    }
+
+    return h->row_pins[c->description->first_pin + row];
+}
+
+// Counts the pins a row stands for. Writes nothing if there are none.
+int format_hidden_pins_row(const connector_t *c, int row_pin, char *buf, size_t len)
+{
+    const connector_description_t *cd = c->description;
+    if (c->pin_view == PIN_VIEW_WIRED) {
+        return snprintf(buf, len, "%d unwired", cd->n_pins - (c->n_rows - 1));
+    }
+    int n_hidden = row_pin == ROW_MORE_ABOVE ? c->first_row : cd->n_pins - c->first_row - PIN_WINDOW_ROWS;
+    if (n_hidden <= 0) {
+        buf[0] = '\0';
+        return 0;
+    }
+
+    return snprintf(buf, len, "%s %d more", row_pin == ROW_MORE_ABOVE ? "^" : "v", n_hidden);
+}
+
+int find_connector_under_pointer(program_state_t *state, harness_t *h)
+{
+    return find_connector_at(state, h, state->mouse_position);
+}
+
+// Shows all pins, then only wired pins, then a scrolling window of pins
+void cycle_pin_view(program_state_t *state)
+{
+    if (state->harnesses == NULL || state->harness_index < 0 || state->harness_index >= state->n_harnesses) {
+        return;
+    }
+    harness_t *h = &state->harnesses[state->harness_index];
+    int i = find_connector_under_pointer(state, h);
+    if (i < 0) {
+        return;
+    }
+    connector_t *c = &h->connectors[i];
+    if (c->pin_view == PIN_VIEW_ALL) {
+        c->pin_view = PIN_VIEW_WIRED;
+    } else if (c->pin_view == PIN_VIEW_WIRED && c->description->n_pins > PIN_WINDOW_ROWS + 2) {
+        c->pin_view = PIN_VIEW_WINDOW;
+    } else {
+        c->pin_view = PIN_VIEW_ALL;
+    }
+    invalidate_connector_layout(state, state->harness_index, i);
+}
+
+// Scrolls the pin window of the connector under the pointer. Its size does
+// not change, so only its own wires are moved.
+void scroll_pin_window(program_state_t *state, int rows)
+{
+    if (state->harnesses == NULL || state->harness_index < 0 || state->harness_index >= state->n_harnesses) {
+        return;
+    }
+    harness_t *h = &state->harnesses[state->harness_index];
+    int i = find_connector_under_pointer(state, h);
+    if (i < 0) {
+        return;
+    }
+    connector_t *c = &h->connectors[i];
+    if (c->pin_view != PIN_VIEW_WINDOW || c->needs_layout) {
+        return;
+    }
+    int first_row = c->first_row;
+    c->first_row += rows;
+    update_connector_rows(h, c);
+    if (c->first_row != first_row) {
+        move_connector(state, h, i, (Vector2){c->outline.x, c->outline.y});
+        h->tracks_stale = 1;
+    }
+}
+
+// Measures and places whatever has changed, and caches the wire geometry
+int lay_out_harness(program_state_t *state, harness_t *h, variant_mask_t variants)
+{
+    update_harness_layout(state, h);
+    place_connectors(state, h, variants);
+
+    return update_wire_geometry(state, h);
+}
+
+// Starts laying out the previous and next harnesses, as they are shown when
+// switched to, with every variant
+int start_prefetch_job(program_state_t *state)
+{
+    prefetch_job_t *job = &state->prefetch_job;
+    if (job->running || state->harnesses == NULL) {
+        return 0;
+    }
+    if (job->started && job->harness_index == state->harness_index && job->n_columns == state->n_columns && job->orthogonal == state->orthogonal && job->revision == state->revision) {
+        return 0;
+    }
+    job->started = 1;
+    job->harness_index = state->harness_index;
+    job->n_columns = state->n_columns;
+    job->orthogonal = state->orthogonal;
+    job->revision = state->revision;
+    job->n_harnesses = 0;
+    int neighbours[2] = {state->harness_index - 1, state->harness_index + 1};
+    for (int i = 0; i < 2; ++i) {
+        if (neighbours[i] >= 0 && neighbours[i] < state->n_harnesses && state->harnesses[neighbours[i]].n_connectors > 0) {
+            job->harnesses[job->n_harnesses++] = neighbours[i];
+        }
+    }
+    if (job->n_harnesses == 0) {
+        return 0;
+    }
+    job->state = state;
+    atomic_store(&job->done, 0);
+    if (pthread_create(&job->thread, NULL, run_prefetch_job, job) != 0) {
+        // Leave them to be laid out when they are shown
+        return 1;
+    }
+    job->running = 1;
+
+    return 0;
+}
+
+void *run_prefetch_job(void *arg)
+{
+    prefetch_job_t *job = arg;
+    for (int i = 0; i < job->n_harnesses; ++i) {
+        (void)lay_out_harness(job->state, &job->state->harnesses[job->harnesses[i]], ALL_VARIANTS);
+    }
+    atomic_store(&job->done, 1);
+
+    return NULL;
+}
+
+void poll_prefetch_job(program_state_t *state)
+{
+    if (state->prefetch_job.running && atomic_load(&state->prefetch_job.done)) {
+        finish_prefetch_job(state);
+    }
+}
+
+// Waits for the layouts in progress, if any
+void finish_prefetch_job(program_state_t *state)
+{
+    prefetch_job_t *job = &state->prefetch_job;
+    if (job->running) {
+        pthread_join(job->thread, NULL);
+        job->running = 0;
+    }
+}
+
+// Gives each wire between two pins a vertical track in the gap nearest its
+// ends. In each gap the wires' vertical runs are intervals, and tracks are
+// handed out as in colouring an interval graph: taking the runs from the
+// top, each reuses a track whose last run has ended, so a gap needs only as
+// many tracks as the most runs crossing any one row. The tracks are then
+// spread evenly across the gap.
+int assign_wire_tracks(harness_t *h)
+{
+    wire_table_t *wires = &h->description->wires;
+    int n = 0;
+    for (int i = 0; i < wires->n_wires; ++i) {
+        if (h->curves[i].valid) {
+            n++;
+        }
+    }
+    if (n == 0) {
+        return 0;
+    }
+    track_interval_t *intervals = malloc(sizeof *intervals * n);
+    track_end_t *active = malloc(sizeof *active * n);
+    int *free_tracks = malloc(sizeof *free_tracks * n);
+    if (intervals == NULL || active == NULL || free_tracks == NULL) {
+        fprintf(stderr, "Error allocating memory\n");
+        free(intervals);
+        free(active);
+        free(free_tracks);
+        return 1;
+    }
+
+    wire_curve_t *wc = NULL;
+    track_interval_t *t = NULL;
+    float mid_x = 0.0;
+    n = 0;
+    for (int i = 0; i < wires->n_wires; ++i) {
+        wc = &h->curves[i];
+        if (!wc->valid) {
+            continue;
+        }
+        t = &intervals[n++];
+        t->wire = i;
+        t->top = fminf(wc->points[0].y, wc->points[3].y);
+        t->bottom = fmaxf(wc->points[0].y, wc->points[3].y);
+        t->gap = 0;
+        mid_x = (wc->points[0].x + wc->points[3].x) / 2;
+        for (int k = 1; k < h->n_gaps; ++k) {
+            if (fabsf(h->gaps[k] + CONNECTOR_SPACING_X / 2 - mid_x) < fabsf(h->gaps[t->gap] + CONNECTOR_SPACING_X / 2 - mid_x)) {
+                t->gap = k;
+            }
+        }
+    }
+    qsort(intervals, n, sizeof *intervals, compare_track_intervals);
+
+    int n_tracks[MAX_COLUMNS] = {0};
+    int n_active = 0;
+    int n_free = 0;
+    for (int i = 0; i < n; ++i) {
+        t = &intervals[i];
+        if (i == 0 || t->gap != intervals[i - 1].gap) {
+            n_active = 0;
+            n_free = 0;
+        }
+        while (n_active > 0 && active[0].bottom < t->top) {
+            free_tracks[n_free++] = pop_track_end(active, &n_active).track;
+        }
+        t->track = n_free > 0 ? free_tracks[--n_free] : n_tracks[t->gap]++;
+        push_track_end(active, &n_active, (track_end_t){t->bottom, t->track});
+    }
+    for (int i = 0; i < n; ++i) {
+        t = &intervals[i];
+        h->curves[t->wire].track_x = h->gaps[t->gap] + (float)CONNECTOR_SPACING_X * (float)(t->track + 1) / (float)(n_tracks[t->gap] + 1);
+    }
+
+    free(intervals);
+    free(active);
+    free(free_tracks);
+
+    return 0;
+}
+
+int compare_track_intervals(const void *a, const void *b)
+{
+    const track_interval_t *ta = a;
+    const track_interval_t *tb = b;
+    if (ta->gap != tb->gap) {
+        return ta->gap - tb->gap;
+    }
+    if (ta->top != tb->top) {
+        return ta->top < tb->top ? -1 : 1;
+    }
+
+    return ta->wire - tb->wire;
+}
+
+// The tracks in use are kept in a binary heap, soonest ending first
+void push_track_end(track_end_t *heap, int *n, track_end_t t)
+{
+    int i = (*n)++;
+    int parent = 0;
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (heap[parent].bottom <= t.bottom) {
+            break;
+        }
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = t;
+}
+
+track_end_t pop_track_end(track_end_t *heap, int *n)
+{
+    track_end_t top = heap[0];
+    track_end_t last = heap[--(*n)];
+    int i = 0;
+    int child = 0;
+    while ((child = 2 * i + 1) < *n) {
+        if (child + 1 < *n && heap[child + 1].bottom < heap[child].bottom) {
+            child++;
+        }
+        if (last.bottom <= heap[child].bottom) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    if (*n > 0) {
+        heap[i] = last;
+    }
+
+    return top;
+}
+
+// Files each wire under the first of its ends that is a net vertex. That
+// vertex's net decides whether the wire is lit, so walking a net's vertices
+// finds each of its wires once.
+int update_vertex_wires(harness_description_t *hd)
+{
+    vertex_wires_t *vw = &hd->vertex_wires;
+    wire_table_t *t = &hd->wires;
+    int n_vertices = hd->n_pins + hd->n_splices;
+    if (vw->offsets != NULL && vw->compactions == t->compactions && vw->n_vertices == n_vertices && t->n_wires - vw->n_rows <= VERTEX_WIRES_MAX_APPENDED) {
+        return 0;
+    }
+    if (n_vertices + 1 > vw->max_offsets) {
+        void *mem = realloc(vw->offsets, sizeof *vw->offsets * (n_vertices + 1));
+        if (mem == NULL) {
+            fprintf(stderr, "Error allocating memory\n");
+            return 1;
+        }
+        vw->offsets = mem;
+        vw->max_offsets = n_vertices + 1;
+    }
+    if (build_csr(n_vertices, t->n_wires, vertex_wire_keys, hd, vw->offsets, &vw->wires, &vw->max_wires) != 0) {
+        free_vertex_wires(vw);
+        return 1;
+    }
+    vw->compactions = t->compactions;
+    vw->n_rows = t->n_wires;
+    vw->n_vertices = n_vertices;
+
+    return 0;
+}
+
+void free_vertex_wires(vertex_wires_t *vw)
+{
+    free(vw->offsets);
+    free(vw->wires);
+    memset(vw, 0, sizeof *vw);
+}
+
+int vertex_wire_keys(const void *context, int wire, int *keys)
+{
+    const harness_description_t *hd = context;
+    const wire_table_t *t = &hd->wires;
+    keys[0] = endpoint_vertex(hd, t->end1[wire]);
+    if (keys[0] < 0) {
+        keys[0] = endpoint_vertex(hd, t->end2[wire]);
+    }
+
+    return keys[0] >= 0;
+}
+
+// Collects the pins and wires on the nets with the given sorted roots by
+// walking each net's vertex list, unless they were collected for the same
+// nets already. Expects the nets to be current for variants.
+int update_lit_set(harness_t *h, const int *roots, int n_roots, variant_mask_t variants)
+{
+    harness_description_t *hd = h->description;
+    net_table_t *nets = &hd->nets;
+    wire_table_t *t = &hd->wires;
+    vertex_wires_t *vw = &hd->vertex_wires;
+    lit_set_t *lit = &h->lit;
+    if (lit->n_roots == n_roots && lit->wire_version == t->version && lit->variants == variants && lit->n_vertices == nets->n_vertices && memcmp(lit->roots, roots, sizeof *roots * n_roots) == 0) {
+        return 0;
+    }
+    lit->n_roots = 0;
+    if (update_vertex_wires(hd) != 0) {
+        return 1;
+    }
+
+    void *mem = NULL;
+    int wire = 0;
+    int v = 0;
+    lit->n_pins = 0;
+    lit->n_wires = 0;
+    for (int k = 0; k < n_roots; ++k) {
+        v = roots[k];
+        do {
+            if (v < hd->n_pins) {
+                if (lit->n_pins == lit->max_pins) {
+                    int n = lit->max_pins > 0 ? 2 * lit->max_pins : 64;
+                    mem = realloc(lit->pins, sizeof *lit->pins * n);
+                    if (mem == NULL) {
+                        fprintf(stderr, "Error allocating memory\n");
+                        return 1;
+                    }
+                    lit->pins = mem;
+                    lit->max_pins = n;
+                }
+                lit->pins[lit->n_pins++] = v;
+            }
+            for (int j = vw->offsets[v]; j < vw->offsets[v + 1]; ++j) {
+                wire = vw->wires[j];
+                if (!WIRE_IS_DEAD(t, wire) && wire_in_variants(hd, wire, variants) && add_lit_wire(lit, wire) != 0) {
+                    return 1;
+                }
+            }
+            v = nets->next[v];
+        } while (v != roots[k]);
+    }
+    // Wires appended since the index was built
+    int root = 0;
+    for (wire = vw->n_rows; wire < t->n_wires; ++wire) {
+        if (WIRE_IS_DEAD(t, wire) || !wire_in_variants(hd, wire, variants) || vertex_wire_keys(hd, wire, &v) == 0) {
+            continue;
+        }
+        root = net_find(nets, v);
+        for (int k = 0; k < n_roots; ++k) {
+            if (roots[k] == root) {
+                if (add_lit_wire(lit, wire) != 0) {
+                    return 1;
+                }
+                break;
+            }
+        }
+    }
+    memcpy(lit->roots, roots, sizeof *roots * n_roots);
+    lit->n_roots = n_roots;
+    lit->wire_version = t->version;
+    lit->variants = variants;
+    lit->n_vertices = nets->n_vertices;
+
+    return 0;
+}
+
+int add_lit_wire(lit_set_t *lit, int wire)
+{
+    if (lit->n_wires == lit->max_wires) {
+        int n = lit->max_wires > 0 ? 2 * lit->max_wires : 64;
+        void *mem = realloc(lit->wires, sizeof *lit->wires * n);
+        if (mem == NULL) {
+            fprintf(stderr, "Error allocating memory\n");
+            return 1;
+        }
+        lit->wires = mem;
+        lit->max_wires = n;
+    }
+    lit->wires[lit->n_wires++] = wire;
+
+    return 0;
+}
+
+// Collects up to max_found of the connectors in the selected variants whose
+// outline holds point, lowest index first. Only the grid cell holding point
+// is looked at.
+int find_connectors_at(program_state_t *state, harness_t *h, Vector2 point, int *found, int max_found)
+{
+    variant_mask_t variants = selected_variants(state, h->description);
+    spatial_grid_t *g = &h->grid;
+    grid_cell_t *cell = grid_cell(g, (int32_t)floorf(point.x / GRID_CELL_SIZE), (int32_t)floorf(point.y / GRID_CELL_SIZE), 0);
+    if (cell == NULL) {
+        return 0;
+    }
+    prune_grid_cell(g, cell);
+    int n_found = 0;
+    int item = 0;
+    int k = 0;
+    for (int j = 0; j < cell->n_entries; ++j) {
+        item = cell->entries[j].item;
+        if (item >= h->n_connectors || !(h->connectors[item].description->variants & variants) || !CheckCollisionPointRec(point, h->connectors[item].outline)) {
+            continue;
+        }
+        k = n_found < max_found ? n_found++ : max_found;
+        while (k > 0 && found[k - 1] > item) {
+            if (k < max_found) {
+                found[k] = found[k - 1];
+            }
+            k--;
+        }
+        if (k < max_found) {
+            found[k] = item;
+        }
+    }
+
+    return n_found;
+}
+
+// The lowest-numbered connector at point, or -1
+int find_connector_at(program_state_t *state, harness_t *h, Vector2 point)
+{
+    int found = -1;
+    if (find_connectors_at(state, h, point, &found, 1) == 0) {
+        return -1;
+    }
+
+    return found;
+}
+
+// Rows are evenly spaced below the name and type rows, so the pin at point
+// is found from its offset instead of testing every row. Returns the pin's
+// index in the connector, or -1, and the row's box if row_box is not NULL.
+int find_pin_at(program_state_t *state, harness_t *h, int connector, Vector2 point, Rectangle *row_box)
+{
+    connector_t *c = &h->connectors[connector];
+    if (c->line_height <= 0) {
+        return -1;
+    }
+    // Same rounding as draw_connector()
+    int top = c->outline.y + CONNECTOR_OUTLINE_GAP;
+    top += 2 * c->line_height;
+    int row = (int)floorf((point.y - top) / c->line_height);
+    if (row < 0 || row >= c->n_rows) {
+        return -1;
+    }
+    int i = connector_row_pin(h, c, row);
+    if (i < 0) {
+        return -1;
+    }
+    int xoff = 0;
+    if (c->facing_left) {
+        xoff = c->outline.x + CONNECTOR_OUTLINE_GAP;
+    } else {
+        xoff = c->outline.x + c->outline.width - CONNECTOR_OUTLINE_GAP - c->pin_row_width;
+    }
+    int pin_id = c->description->first_pin + i;
+    Rectangle box = {xoff, top + row * c->line_height, c->facing_left ? h->pin_widths[pin_id] : c->pin_row_width, state->font_sizes[c->font]};
+    if (!CheckCollisionPointRec(point, box)) {
+        return -1;
+    }
+    if (row_box != NULL) {
+        *row_box = box;
+    }
+
+    return i;
+}
+
+// Marks the pins under the pointer, which are also lit, and picks them up as
+// the ends of a wire being drawn while the left button is down
+void find_pins_under_pointer(program_state_t *state, harness_t *h)
+{
+    harness_description_t *hd = h->description;
+    view_state_t *view = &state->view;
+    int connectors[MAX_LIT_NETS] = {0};
+    int n_connectors = find_connectors_at(state, h, state->mouse_position, connectors, MAX_LIT_NETS);
+    Rectangle box = {0};
+    connector_t *c = NULL;
+    int i = 0;
+    int pin_id = 0;
+    for (int j = 0; j < n_connectors; ++j) {
+        c = &h->connectors[connectors[j]];
+        i = find_pin_at(state, h, connectors[j], state->mouse_position, &box);
+        if (i < 0) {
+            continue;
+        }
+        pin_id = c->description->first_pin + i;
+        BITSET_SET(view->pin_highlighted, pin_id);
+        BITSET_SET(view->pin_under_pointer, pin_id);
+        if (view->n_hovered_pins < MAX_LIT_NETS) {
+            view->hovered_pin_names[view->n_hovered_pins] = c->description->pins[i].name;
+            view->hovered_pins[view->n_hovered_pins++] = pin_id;
+        }
+        if (!IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
+            continue;
+        }
+        Vector2 end = {c->facing_left ? box.x : box.x + box.width, box.y + box.height / 2.0};
+        end.x = (int)end.x;
+        end.y = (int)end.y;
+        handle_t ph = pin_handle(hd, connectors[j], i);
+        if (state->n_pins_under_pointer == 0) {
+            state->wire_drawing_first_end = end;
+            state->p1_under_pointer = ph;
+            state->n_pins_under_pointer = 1;
+        } else if (state->n_pins_under_pointer == 1 && !HANDLES_EQUAL(ph, state->p1_under_pointer)) {
+            state->wire_drawing_second_end = end;
+            state->p2_under_pointer = ph;
+            state->n_pins_under_pointer = 2;
+        } else if (state->n_pins_under_pointer == 2 && !HANDLES_EQUAL(ph, state->p2_under_pointer)) {
+            state->wire_drawing_second_end = end;
+            state->p2_under_pointer = ph;
+        }
+    }
+}
+
+float segment_distance(Vector2 p, Vector2 a, Vector2 b)
+{
+    float dx = b.x - a.x;
+    float dy = b.y - a.y;
+    float len2 = dx * dx + dy * dy;
+    float t = 0.0f;
+    if (len2 > 0.0f) {
+        t = ((p.x - a.x) * dx + (p.y - a.y) * dy) / len2;
+        t = fminf(fmaxf(t, 0.0f), 1.0f);
+    }
+
+    return hypotf(p.x - (a.x + t * dx), p.y - (a.y + t * dy));
+}
+
+// Distance from p to a wire's centre line. Curves are split into
+// WIRE_HIT_SEGMENTS straight pieces.
+float wire_distance(const wire_curve_t *wc, int orthogonal, Vector2 p)
+{
+    float d = INFINITY;
+    if (orthogonal) {
+        for (int k = 0; k < 3; ++k) {
+            d = fminf(d, segment_distance(p, wc->points[k], wc->points[k + 1]));
+        }
+        return d;
+    }
+    Vector2 a = wc->points[0];
+    Vector2 b = {0};
+    for (int k = 1; k <= WIRE_HIT_SEGMENTS; ++k) {
+        b = GetSplinePointBezierCubic(wc->points[0], wc->points[1], wc->points[2], wc->points[3], (float)k / WIRE_HIT_SEGMENTS);
+        d = fminf(d, segment_distance(p, a, b));
+        a = b;
+    }
+
+    return d;
+}
+
+// Returns the wire whose edge is nearest to point and at most tolerance away,
+// or -1. Only wires in the grid cell holding point are measured, so the
+// tolerance should not exceed WIRE_BOUNDS_MARGIN. Wires to splices are not in
+// the grid and are never found.
+int find_wire_at(program_state_t *state, harness_t *h, Vector2 point, float tolerance)
+{
+    harness_description_t *hd = h->description;
+    wire_table_t *wires = &hd->wires;
+    variant_mask_t variants = selected_variants(state, hd);
+    spatial_grid_t *g = &h->grid;
+    if (h->geometry_stale) {
+        return -1;
+    }
+    grid_cell_t *cell = grid_cell(g, (int32_t)floorf(point.x / GRID_CELL_SIZE), (int32_t)floorf(point.y / GRID_CELL_SIZE), 0);
+    if (cell == NULL) {
+        return -1;
+    }
+    prune_grid_cell(g, cell);
+    int best = -1;
+    float best_distance = INFINITY;
+    float d = 0.0f;
+    int wire = 0;
+    for (int k = 0; k < cell->n_entries; ++k) {
+        wire = cell->entries[k].item - h->n_connectors;
+        if (wire < 0 || wire >= wires->n_wires || WIRE_IS_DEAD(wires, wire) || !wire_in_variants(hd, wire, variants) || !h->curves[wire].valid || !CheckCollisionPointRec(point, h->curves[wire].bounds)) {
+            continue;
+        }
+        d = wire_distance(&h->curves[wire], h->geometry_orthogonal, point) - wires->thickness[wire] / 2.0f;
+        if (d <= tolerance && (d < best_distance || (d == best_distance && wire < best))) {
+            best = wire;
+            best_distance = d;
+        }
+    }
+
+    return best;
+}
+
+// Finds the wire under the pointer, unless a pin or connector is, and lights
+// it and the selected wires
+void find_wire_under_pointer(program_state_t *state, harness_t *h)
+{
+    harness_description_t *hd = h->description;
+    view_state_t *view = &state->view;
+    int wire = -1;
+    if (view->n_hovered_pins == 0 && find_connector_at(state, h, state->mouse_position) < 0) {
+        wire = find_wire_at(state, h, state->mouse_position, fminf(WIRE_HIT_TOLERANCE / state->camera.zoom, WIRE_BOUNDS_MARGIN));
+    }
+    if (wire >= 0) {
+        view->wire_under_pointer = wire_handle(&hd->wires, wire);
+        BITSET_SET(view->wire_highlighted, wire);
+    }
+    for (wire = next_selected_wire(state, 0); wire >= 0; wire = next_selected_wire(state, wire + 1)) {
+        BITSET_SET(view->wire_highlighted, wire);
+    }
+}
+
+// The wire under the pointer as a row of the current harness's wire table,
+// or -1
+int picked_wire(program_state_t *state)
+{
+    harness_description_t *hd = &state->harness_descriptions[state->harness_index];
+    int wire = resolve_wire(&hd->wires, state->view.wire_under_pointer);
+    if (wire >= 0 && !wire_in_variants(hd, wire, selected_variants(state, hd))) {
+        wire = -1;
+    }
+
+    return wire;
+}
+
+// While a variant is selected, wires are only taken out of that variant,
+// and deleted once they belong to none
+void remove_wire(program_state_t *state, harness_description_t *hd, int wire, variant_mask_t variants)
+{
+    wire_table_t *wires = &hd->wires;
+    mark_harness_edited(state, hd);
+    if (variants != ALL_VARIANTS) {
+        edit_value_t before = {.variants = wires->variants[wire]};
+        wires->variants[wire] &= ~variants;
+        MARK_WIRE_CHANGED(wires, wire);
+        record_wire_change(state, hd, EDIT_WIRE_VARIANTS, wire, before, (edit_value_t){.variants = wires->variants[wire]});
+        if ((wires->variants[wire] & declared_variants(hd)) != 0) {
+            // Variant membership changes the nets
+            wires->version++;
+            return;
+        }
+    }
+    record_wire_presence(state, hd, EDIT_DELETE_WIRE, wire);
+    delete_wire(wires, wire);
+    deselect_wire(state, (int)(hd - state->harness_descriptions), wire);
+}
+
+void recolour_wire(program_state_t *state, harness_description_t *hd, int wire, int direction)
+{
+    wire_table_t *wires = &hd->wires;
+    edit_value_t before = {.colour = wires->colour[wire]};
+    const char *colour = string_from_id(&state->strings, wires->colour[wire]);
+    if (direction == 1) {
+        wires->colour[wire] = intern_string(&state->strings, next_colour(colour));
+    } else {
+        wires->colour[wire] = intern_string(&state->strings, previous_colour(colour));
+    }
+    MARK_WIRE_CHANGED(wires, wire);
+    record_wire_change(state, hd, EDIT_WIRE_COLOUR, wire, before, (edit_value_t){.colour = wires->colour[wire]});
+    mark_harness_edited(state, hd);
+}
+
+void thicken_wire(program_state_t *state, harness_description_t *hd, int wire, float delta_amount)
+{
+    wire_table_t *wires = &hd->wires;
+    edit_value_t before = {.thickness = wires->thickness[wire]};
+    wires->thickness[wire] += delta_amount;
+    if (wires->thickness[wire] < 0.5) {
+        wires->thickness[wire] = 0.5;
+    }
+    MARK_WIRE_CHANGED(wires, wire);
+    record_wire_change(state, hd, EDIT_WIRE_THICKNESS, wire, before, (edit_value_t){.thickness = wires->thickness[wire]});
+    mark_harness_edited(state, hd);
+    refresh_wire_bounds(state, hd, wire);
+}
+
+int reserve_selection(selection_t *s, int n_wires, int n_connectors)
+{
+    int n_wire_words = BITSET_WORDS(n_wires > 0 ? n_wires : 1);
+    int n_connector_words = BITSET_WORDS(n_connectors > 0 ? n_connectors : 1);
+    void *mem = NULL;
+    if (n_wire_words > s->max_wire_words) {
+        mem = realloc(s->wires, sizeof *s->wires * n_wire_words);
+        if (mem == NULL) {
+            fprintf(stderr, "Error allocating memory\n");
+            return 1;
+        }
+        s->wires = mem;
+        memset(&s->wires[s->max_wire_words], 0, sizeof *s->wires * (n_wire_words - s->max_wire_words));
+        s->max_wire_words = n_wire_words;
+    }
+    if (n_connector_words > s->max_connector_words) {
+        mem = realloc(s->connectors, sizeof *s->connectors * n_connector_words);
+        if (mem == NULL) {
+            fprintf(stderr, "Error allocating memory\n");
+            return 1;
+        }
+        s->connectors = mem;
+        memset(&s->connectors[s->max_connector_words], 0, sizeof *s->connectors * (n_connector_words - s->max_connector_words));
+        s->max_connector_words = n_connector_words;
+    }
+
+    return 0;
+}
+
+// Empties the selection and moves it to the current harness
+void clear_selection(program_state_t *state)
+{
+    selection_t *s = &state->selection;
+    if (s->max_wire_words > 0) {
+        memset(s->wires, 0, sizeof *s->wires * s->max_wire_words);
+    }
+    if (s->max_connector_words > 0) {
+        memset(s->connectors, 0, sizeof *s->connectors * s->max_connector_words);
+    }
+    s->harness = state->harness_index;
+}
+
+// Returns the first selected wire at or after row start that is live and in
+// the selected variants, or -1. Empty words are skipped whole.
+int next_selected_wire(program_state_t *state, int start)
+{
+    selection_t *s = &state->selection;
+    if (s->harness != state->harness_index || state->harness_index < 0 || state->harness_index >= state->n_harnesses) {
+        return -1;
+    }
+    harness_description_t *hd = &state->harness_descriptions[state->harness_index];
+    wire_table_t *t = &hd->wires;
+    variant_mask_t variants = selected_variants(state, hd);
+    int n = t->n_wires < s->max_wire_words * 64 ? t->n_wires : s->max_wire_words * 64;
+    for (int i = start; i < n; ++i) {
+        if (s->wires[i >> 6] == 0) {
+            i |= 63;
+            continue;
+        }
+        if (BITSET_TEST(s->wires, i) && !WIRE_IS_DEAD(t, i) && wire_in_variants(hd, i, variants)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+int next_selected_connector(program_state_t *state, int start)
+{
+    selection_t *s = &state->selection;
+    if (s->harness != state->harness_index || state->harness_index < 0 || state->harness_index >= state->n_harnesses) {
+        return -1;
+    }
+    harness_description_t *hd = &state->harness_descriptions[state->harness_index];
+    variant_mask_t variants = selected_variants(state, hd);
+    int n = hd->n_connector_descriptions < s->max_connector_words * 64 ? hd->n_connector_descriptions : s->max_connector_words * 64;
+    for (int i = start; i < n; ++i) {
+        if (s->connectors[i >> 6] == 0) {
+            i |= 63;
+            continue;
+        }
+        if (BITSET_TEST(s->connectors, i) && (hd->connector_descriptions[i].variants & variants)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// Moves selected wires to their rows after compaction. Rows only move down,
+// so the bits can be moved in place in row order.
+void remap_selection(selection_t *s, const int *remap, int n_rows)
+{
+    int n = n_rows < s->max_wire_words * 64 ? n_rows : s->max_wire_words * 64;
+    for (int i = 0; i < n; ++i) {
+        if (BITSET_TEST(s->wires, i)) {
+            BITSET_CLEAR(s->wires, i);
+            if (remap[i] >= 0) {
+                BITSET_SET(s->wires, remap[i]);
+            }
+        }
+    }
+}
+
+void free_selection(program_state_t *state)
+{
+    free(state->selection.wires);
+    free(state->selection.connectors);
+    memset(&state->selection, 0, sizeof state->selection);
+    free(state->band.points);
+    free(state->band.items);
+    memset(&state->band, 0, sizeof state->band);
+}
+
+// A click on a wire selects just it, or with shift held adds or removes it. A
+// press anywhere else that is not on a pin or connector starts a rubber band.
+void start_selection(program_state_t *state)
+{
+    if (state->drag.active || state->view.n_hovered_pins > 0 || state->harness_index < 0 || state->harness_index >= state->n_harnesses) {
+        return;
+    }
+    harness_description_t *hd = &state->harness_descriptions[state->harness_index];
+    selection_t *s = &state->selection;
+    int add = IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT);
+    int wire = resolve_wire(&hd->wires, state->view.wire_under_pointer);
+    if (wire >= 0) {
+        if (!add || s->harness != state->harness_index) {
+            clear_selection(state);
+        }
+        if (reserve_selection(s, hd->wires.n_wires, hd->n_connector_descriptions) != 0) {
+            return;
+        }
+        if (add && BITSET_TEST(s->wires, wire)) {
+            BITSET_CLEAR(s->wires, wire);
+        } else {
+            BITSET_SET(s->wires, wire);
+        }
+        return;
+    }
+
+    rubber_band_t *b = &state->band;
+    if (b->max_points < 2) {
+        void *mem = realloc(b->points, sizeof *b->points * 64);
+        if (mem == NULL) {
+            fprintf(stderr, "Error allocating memory\n");
+            return;
+        }
+        b->points = mem;
+        b->max_points = 64;
+    }
+    b->active = 1;
+    b->lasso = IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL);
+    b->add = add;
+    b->points[0] = state->mouse_position;
+    b->points[1] = state->mouse_position;
+    b->n_points = b->lasso ? 1 : 2;
+}
+
+// A box follows the pointer; a lasso gains a point whenever the pointer has
+// moved far enough
+void extend_rubber_band(program_state_t *state)
+{
+    rubber_band_t *b = &state->band;
+    if (!b->lasso) {
+        b->points[1] = state->mouse_position;
+        return;
+    }
+    Vector2 last = b->points[b->n_points - 1];
+    if (hypotf(state->mouse_position.x - last.x, state->mouse_position.y - last.y) * state->camera.zoom < LASSO_POINT_SPACING) {
+        return;
+    }
+    if (b->n_points == b->max_points) {
+        void *mem = realloc(b->points, sizeof *b->points * 2 * b->max_points);
+        if (mem == NULL) {
+            fprintf(stderr, "Error allocating memory\n");
+            return;
+        }
+        b->points = mem;
+        b->max_points *= 2;
+    }
+    b->points[b->n_points++] = state->mouse_position;
+}
+
+Rectangle rubber_band_box(const rubber_band_t *b)
+{
+    float x0 = b->points[0].x;
+    float y0 = b->points[0].y;
+    float x1 = x0;
+    float y1 = y0;
+    for (int k = 1; k < b->n_points; ++k) {
+        x0 = fminf(x0, b->points[k].x);
+        y0 = fminf(y0, b->points[k].y);
+        x1 = fmaxf(x1, b->points[k].x);
+        y1 = fmaxf(y1, b->points[k].y);
+    }
+
+    return (Rectangle){x0, y0, x1 - x0, y1 - y0};
+}
+
+int band_holds_point(const rubber_band_t *b, Rectangle box, Vector2 p)
+{
+    if (!CheckCollisionPointRec(p, box)) {
+        return 0;
+    }
+    if (b->lasso) {
+        return CheckCollisionPointPoly(p, b->points, b->n_points);
+    }
+
+    return 1;
+}
+
+// A wire is inside when every point its path is drawn through is
+int band_holds_wire(const rubber_band_t *b, Rectangle box, const wire_curve_t *wc, int orthogonal)
+{
+    if (orthogonal) {
+        for (int k = 0; k < 4; ++k) {
+            if (!band_holds_point(b, box, wc->points[k])) {
+                return 0;
+            }
+        }
+        return 1;
+    }
+    Vector2 p = {0};
+    for (int k = 0; k <= WIRE_HIT_SEGMENTS; ++k) {
+        p = GetSplinePointBezierCubic(wc->points[0], wc->points[1], wc->points[2], wc->points[3], (float)k / WIRE_HIT_SEGMENTS);
+        if (!band_holds_point(b, box, p)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Selects the connectors and wires lying wholly inside the band, from the
+// grid cells it covers. A band too small to be a drag is a click on nothing,
+// which clears the selection unless shift was held.
+int finish_rubber_band(program_state_t *state)
+{
+    rubber_band_t *b = &state->band;
+    extend_rubber_band(state);
+    b->active = 0;
+    if (state->harness_index < 0 || state->harness_index >= state->n_harnesses) {
+        return 0;
+    }
+    harness_t *h = &state->harnesses[state->harness_index];
+    harness_description_t *hd = h->description;
+    selection_t *s = &state->selection;
+    if (!b->add || s->harness != state->harness_index) {
+        clear_selection(state);
+    }
+    Rectangle box = rubber_band_box(b);
+    if ((box.width * state->camera.zoom < BAND_MIN_SIZE && box.height * state->camera.zoom < BAND_MIN_SIZE) || (b->lasso && b->n_points < 3) || h->geometry_stale) {
+        return 0;
+    }
+    if (reserve_selection(s, hd->wires.n_wires, hd->n_connector_descriptions) != 0) {
+        return 1;
+    }
+    b->n_items = 0;
+    if (grid_query(&h->grid, box, &b->items, &b->n_items, &b->max_items) != 0) {
+        return 1;
+    }
+
+    variant_mask_t variants = selected_variants(state, hd);
+    wire_table_t *wires = &hd->wires;
+    Rectangle r = {0};
+    int item = 0;
+    int wire = 0;
+    for (int k = 0; k < b->n_items; ++k) {
+        item = b->items[k];
+        if (item < h->n_connectors) {
+            r = h->connectors[item].outline;
+            if ((h->connectors[item].description->variants & variants) && band_holds_point(b, box, (Vector2){r.x, r.y}) && band_holds_point(b, box, (Vector2){r.x + r.width, r.y}) && band_holds_point(b, box, (Vector2){r.x, r.y + r.height}) && band_holds_point(b, box, (Vector2){r.x + r.width, r.y + r.height})) {
+                BITSET_SET(s->connectors, item);
+            }
+            continue;
+        }
+        wire = item - h->n_connectors;
+        if (wire < wires->n_wires && !WIRE_IS_DEAD(wires, wire) && wire_in_variants(hd, wire, variants) && h->curves[wire].valid && band_holds_wire(b, box, &h->curves[wire], h->geometry_orthogonal)) {
+            BITSET_SET(s->wires, wire);
+        }
+    }
+
+    return 0;
+}
+
+void draw_rubber_band(program_state_t *state)
+{
+    rubber_band_t *b = &state->band;
+    Color color = get_color_from_string(DEFAULT_HIGHLIGHT_COLOR);
+    if (b->lasso) {
+        DrawLineStrip(b->points, b->n_points, color);
+        DrawLineEx(b->points[b->n_points - 1], b->points[0], 1.0f / state->camera.zoom, color);
+        return;
+    }
+    DrawRectangleLinesEx(rubber_band_box(b), 1.0f / state->camera.zoom, color);
+}
+
+// Pin names never change after loading, so the index is built once by
+// counting the pins with each name and then placing them.
+int build_pin_name_index(program_state_t *state)
+{
+    pin_name_index_t *index = &state->pin_names;
+    free_pin_name_index(index);
+    uint32_t n_names = state->strings.n_strings;
+    index->offsets = calloc(n_names + 1, sizeof *index->offsets);
+    if (index->offsets == NULL) {
+        fprintf(stderr, "Error allocating memory\n");
+        return 1;
+    }
+    index->n_names = n_names;
+
+    harness_description_t *hd = NULL;
+    connector_description_t *cd = NULL;
+    string_id_t name = 0;
+    for (int i = 0; i < state->n_harnesses; ++i) {
+        hd = &state->harness_descriptions[i];
+        for (int j = 0; j < hd->n_connector_descriptions; ++j) {
+            cd = &hd->connector_descriptions[j];
+            for (int k = 0; k < cd->n_pins; ++k) {
+                name = cd->pins[k].name;
+                if (name != 0 && name < n_names) {
+                    index->offsets[name + 1]++;
+                }
+            }
+        }
+    }
+    for (uint32_t s = 0; s < n_names; ++s) {
+        index->offsets[s + 1] += index->offsets[s];
+    }
+    if (index->offsets[n_names] == 0) {
+        return 0;
+    }
+    index->entries = malloc(sizeof *index->entries * index->offsets[n_names]);
+    int *fill = malloc(sizeof *fill * n_names);
+    if (index->entries == NULL || fill == NULL) {
+        fprintf(stderr, "Error allocating memory\n");
+        free(fill);
+        free_pin_name_index(index);
+        return 1;
+    }
+    memcpy(fill, index->offsets, sizeof *fill * n_names);
+    for (int i = 0; i < state->n_harnesses; ++i) {
+        hd = &state->harness_descriptions[i];
+        for (int j = 0; j < hd->n_connector_descriptions; ++j) {
+            cd = &hd->connector_descriptions[j];
+            for (int k = 0; k < cd->n_pins; ++k) {
+                name = cd->pins[k].name;
+                if (name != 0 && name < n_names) {
+                    index->entries[fill[name]++] = (pin_name_entry_t){i, cd->first_pin + k};
+                }
+            }
+        }
+    }
+    free(fill);
+
+    return 0;
+}
+
+void free_pin_name_index(pin_name_index_t *index)
+{
+    free(index->offsets);
+    free(index->entries);
+    memset(index, 0, sizeof *index);
+}
+
+// Lights the pins of the harness shown that have the same name as a pin
+// under the pointer, whether or not they are wired to it
+void highlight_pin_names(program_state_t *state, harness_t *h)
+{
+    if (state->name_highlighting == NAME_HIGHLIGHT_OFF) {
+        return;
+    }
+    view_state_t *view = &state->view;
+    pin_name_index_t *index = &state->pin_names;
+    string_id_t names[MAX_LIT_NETS] = {0};
+    int n_names = view->n_hovered_pins;
+    memcpy(names, view->hovered_pin_names, sizeof *names * n_names);
+    if (state->name_highlighting == NAME_HIGHLIGHT_ALL) {
+        if (n_names > 0) {
+            state->lit_name = names[0];
+        } else if (state->lit_name != 0) {
+            names[n_names++] = state->lit_name;
+        }
+    }
+
+    int harness = (int)(h - state->harnesses);
+    int n_pins = h->description->n_pins;
+    int lo = 0;
+    int hi = 0;
+    int mid = 0;
+    for (int i = 0; i < n_names; ++i) {
+        if (names[i] == 0 || names[i] >= index->n_names) {
+            continue;
+        }
+        // The harness's pins are a run within the name's entries
+        lo = index->offsets[names[i]];
+        hi = index->offsets[names[i] + 1];
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (index->entries[mid].harness < harness) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        hi = index->offsets[names[i] + 1];
+        for (int k = lo; k < hi && index->entries[k].harness == harness; ++k) {
+            if (index->entries[k].pin < n_pins) {
+                BITSET_SET(view->pin_highlighted, index->entries[k].pin);
+            }
+        }
+    }
+}
+
+void cycle_name_highlighting(program_state_t *state)
+{
+    state->name_highlighting = (state->name_highlighting + 1) % N_NAME_HIGHLIGHT_MODES;
+    state->lit_name = 0;
+}
+
+// Points every edit of the wire with this generation at its row
+void relink_wire_edits(edit_history_t *history, int harness, uint32_t generation, int row)
+{
+    edit_stack_t *stacks[] = {&history->undo, &history->redo};
+    edit_t *e = NULL;
+    for (int s = 0; s < 2; ++s) {
+        for (int i = 0; i < stacks[s]->n_edits; ++i) {
+            e = &stacks[s]->edits[i];
+            if (e->harness == harness && e->kind != EDIT_MIRROR_CONNECTOR && e->kind != EDIT_MOVE_CONNECTOR && e->wire.generation == generation) {
+                e->wire.index = (uint32_t)row;
+            }
+        }
+    }
+}
+
+// A thickness change only grows or shrinks the wire's bounds, so the rest of
+// its geometry is kept
+void refresh_wire_bounds(program_state_t *state, harness_description_t *hd, int wire)
+{
+    if (state->harnesses == NULL) {
+        return;
+    }
+    harness_t *h = &state->harnesses[hd - state->harness_descriptions];
+    if (h->geometry_stale || h->geometry_wire_version != hd->wires.version || wire >= h->max_curves || !h->curves[wire].valid) {
+        return;
+    }
+    set_wire_bounds(h, wire);
+    (void)grid_insert(&h->grid, h->n_connectors + wire, h->curves[wire].bounds);
+}
+
+// Deleted rows are revived by undo and redo, and should not come back
+// selected
+void deselect_wire(program_state_t *state, int harness, int wire)
+{
+    selection_t *s = &state->selection;
+    if (s->harness == harness && wire >= 0 && wire < s->max_wire_words * 64) {
+        BITSET_CLEAR(s->wires, wire);
+    }
+}
+
+// Whether a wire edit has anything to act on: a selected wire, the wire under
+// the pointer, or a wire of a pin under the pointer. Edits start their undo
+// step only then, since that waits for the prefetch job.
+int has_wire_to_edit(program_state_t *state, harness_description_t *hd, variant_mask_t variants)
+{
+    if (next_selected_wire(state, 0) >= 0 || picked_wire(state) >= 0) {
+        return 1;
+    }
+    if (state->view.n_hovered_pins == 0) {
+        return 0;
+    }
+    connector_description_t *cd = NULL;
+    for (int j = 0; j < hd->n_connector_descriptions; ++j) {
+        cd = &hd->connector_descriptions[j];
+        for (int k = 0; k < cd->n_pins; ++k) {
+            if (BITSET_TEST(state->view.pin_under_pointer, cd->first_pin + k) && find_last_wire_in_variants(hd, ENDPOINT(cd->number, cd->pins[k].number), variants) >= 0) {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// A wire is at each connector it ends on, once even if both ends are there.
+// Wires without a curve (to splices, or with a missing end) are left out.
+int connector_wire_keys(const void *context, int wire, int *keys)
+{
+    const harness_t *h = context;
+    const wire_table_t *t = &h->description->wires;
+    if (!h->curves[wire].valid) {
+        return 0;
+    }
+    keys[0] = ENDPOINT_CONNECTOR(t->end1[wire]) - 1;
+    keys[1] = ENDPOINT_CONNECTOR(t->end2[wire]) - 1;
+
+    return keys[1] != keys[0] ? 2 : 1;
+}
+
+// Files items 0 to n_items - 1 under the keys given by keys_of, in
+// compressed sparse row form: the items under key k are items[offsets[k]] to
+// items[offsets[k + 1] - 1], in item order. offsets must hold n_keys + 1
+// entries; items is grown as needed. Keys outside 0 to n_keys - 1 are
+// ignored.
+int build_csr(int n_keys, int n_items, csr_keys_fn keys_of, const void *context, int *offsets, int **items, int *max_items)
+{
+    int keys[2] = {0};
+    int n = 0;
+    memset(offsets, 0, sizeof *offsets * (n_keys + 1));
+    // Count the items under each key, then place them
+    for (int i = 0; i < n_items; ++i) {
+        n = keys_of(context, i, keys);
+        for (int k = 0; k < n; ++k) {
+            if (keys[k] >= 0 && keys[k] < n_keys) {
+                offsets[keys[k] + 1]++;
+            }
+        }
+    }
+    for (int k = 0; k < n_keys; ++k) {
+        offsets[k + 1] += offsets[k];
+    }
+    if (offsets[n_keys] > *max_items) {
+        void *mem = realloc(*items, sizeof **items * offsets[n_keys]);
+        if (mem == NULL) {
+            fprintf(stderr, "Error allocating memory\n");
+            return 1;
+        }
+        *items = mem;
+        *max_items = offsets[n_keys];
+    }
+    for (int i = 0; i < n_items; ++i) {
+        n = keys_of(context, i, keys);
+        for (int k = 0; k < n; ++k) {
+            if (keys[k] >= 0 && keys[k] < n_keys) {
+                (*items)[offsets[keys[k]]++] = i;
+            }
+        }
+    }
+    // Placing moved each offset to the next key's start
+    memmove(&offsets[1], &offsets[0], sizeof *offsets * n_keys);
+    offsets[0] = 0;
+
+    return 0;
+}
+
+// Layer of each connector, then each splice, for order_connectors(): 2k for
+// column k, 2k + 1 for the gap right of it, and -1 for placed connectors.
+// Splices go in the gap nearest the mean of the edges their wires leave from,
+// as in layout_splices(). sum and count are scratch, n + n_splices long.
+// Returns the number of columns in use.
+int order_layers(const harness_snapshot_t *hs, variant_mask_t variants, const order_place_t *places, int *layers, float *sum, int *count)
+{
+    const harness_description_t *hd = &hs->description;
+    int n = hd->n_connector_descriptions;
+    int n_used = 1;
+    for (int c = 0; c < n; ++c) {
+        layers[c] = places[c].placed ? -1 : 2 * places[c].column;
+        if (!places[c].placed && (SNAPSHOT_CONNECTOR(hs, c)->variants & variants) && places[c].column + 1 > n_used) {
+            n_used = places[c].column + 1;
+        }
+    }
+    if (hd->n_splices == 0) {
+        return n_used;
+    }
+
+    memset(sum, 0, sizeof *sum * hd->n_splices);
+    memset(count, 0, sizeof *count * hd->n_splices);
+    const wire_table_t *wires = &hd->wires;
+    endpoint_t ends[2] = {0};
+    int s = 0;
+    int c = 0;
+    for (int i = 0; i < wires->n_wires; ++i) {
+        if (SNAPSHOT_WIRE_IS_DEAD(hs, i) || !snapshot_wire_in_variants(hs, i, variants)) {
+            continue;
+        }
+        ends[0] = SNAPSHOT_WIRE(hs, end1, i);
+        ends[1] = SNAPSHOT_WIRE(hs, end2, i);
+        for (int k = 0; k < 2; ++k) {
+            if (!ENDPOINT_IS_SPLICE(ends[k]) || ENDPOINT_IS_SPLICE(ends[1 - k])) {
+                continue;
+            }
+            s = ENDPOINT_PIN(ends[k]) - 1;
+            c = ENDPOINT_CONNECTOR(ends[1 - k]) - 1;
+            if (s < 0 || s >= hd->n_splices || c < 0 || c >= n || layers[c] < 0) {
+                continue;
+            }
+            // Gap k is at k + 0.5 in columns
+            sum[s] += (float)places[c].column + (places[c].facing_left ? -0.5f : 0.5f);
+            count[s]++;
+        }
+    }
+    int n_gaps = n_used > 1 ? n_used - 1 : 1;
+    int gap = 0;
+    for (s = 0; s < hd->n_splices; ++s) {
+        gap = count[s] > 0 ? (int)ceilf(sum[s] / (float)count[s] - 1.0f) : 0;
+        if (gap < 0) {
+            gap = 0;
+        } else if (gap > n_gaps - 1) {
+            gap = n_gaps - 1;
+        }
+        layers[n + s] = 2 * gap + 1;
+    }
+
+    return n_used;
+}
+
+// Starts a fresh record of what is written to a harness, once its snapshot
+// has been published
+void clear_snapshot_changes(harness_description_t *hd)
+{
+    wire_table_t *t = &hd->wires;
+    if (t->changed_chunks != NULL) {
+        memset(t->changed_chunks, 0, sizeof *t->changed_chunks * BITSET_WORDS(SNAPSHOT_WIRE_CHUNKS(t->max_wires)));
+    }
+    t->overrides_changed = 0;
+    int n_words = BITSET_WORDS(SNAPSHOT_CONNECTOR_BLOCKS(hd->n_connector_descriptions));
+    if (hd->changed_connector_blocks == NULL) {
+        // Left NULL if this fails, so the next snapshot copies every block
+        hd->changed_connector_blocks = calloc(n_words > 0 ? n_words : 1, sizeof *hd->changed_connector_blocks);
+    } else {
+        memset(hd->changed_connector_blocks, 0, sizeof *hd->changed_connector_blocks * n_words);
+    }
+}
+
+// Every write to a connector record goes through here
+void mark_connector_changed(harness_description_t *hd, int connector)
+{
+    if (hd->changed_connector_blocks != NULL) {
+        BITSET_SET(hd->changed_connector_blocks, connector / SNAPSHOT_CONNECTOR_BLOCK_SIZE);
+    }
+}
+
+// get_wire() for a snapshot
+wire_description_t get_snapshot_wire(const harness_snapshot_t *hs, int index)
+{
+    wire_description_t wd = {0};
+    wd.c1 = ENDPOINT_CONNECTOR(SNAPSHOT_WIRE(hs, end1, index));
+    wd.c1_pin = ENDPOINT_PIN(SNAPSHOT_WIRE(hs, end1, index));
+    wd.c2 = ENDPOINT_CONNECTOR(SNAPSHOT_WIRE(hs, end2, index));
+    wd.c2_pin = ENDPOINT_PIN(SNAPSHOT_WIRE(hs, end2, index));
+    wd.colour = SNAPSHOT_WIRE(hs, colour, index);
+    wd.thickness = SNAPSHOT_WIRE(hs, thickness, index);
+    wd.straight_fraction = SNAPSHOT_WIRE(hs, straight_fraction, index);
+    wd.variants = SNAPSHOT_WIRE(hs, variants, index);
+    int k = find_wire_override(&hs->description.wires, index);
+    if (k >= 0) {
+        wd.gauge = hs->description.wires.overrides[k].gauge;
+        wd.length = hs->description.wires.overrides[k].length;
+    }
+
+    return wd;
+}
+
+// wire_in_variants() for a snapshot
+int snapshot_wire_in_variants(const harness_snapshot_t *hs, int index, variant_mask_t variants)
+{
+    int n = hs->description.n_connector_descriptions;
+    variant_mask_t mask = SNAPSHOT_WIRE(hs, variants, index) & variants;
+    int c1 = ENDPOINT_CONNECTOR(SNAPSHOT_WIRE(hs, end1, index)) - 1;
+    int c2 = ENDPOINT_CONNECTOR(SNAPSHOT_WIRE(hs, end2, index)) - 1;
+    if (c1 >= 0 && c1 < n) {
+        mask &= SNAPSHOT_CONNECTOR(hs, c1)->variants;
+    }
+    if (c2 >= 0 && c2 < n) {
+        mask &= SNAPSHOT_CONNECTOR(hs, c2)->variants;
+    }
+
+    return mask != 0;
+}